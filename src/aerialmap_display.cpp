@@ -11,6 +11,11 @@
 #include <QtGlobal>
 #include <QImage>
 #include <QDir>
+#include <QUrl>
+
+#include <cmath>
+#include <map>
+#include <set>
 
 #include <ros/ros.h>
 #include <ros/package.h>
@@ -20,7 +25,6 @@
 #include <OGRE/OgreMaterialManager.h>
 #include <OGRE/OgreSceneManager.h>
 #include <OGRE/OgreSceneNode.h>
-#include <OGRE/OgreTextureManager.h>
 #include <OGRE/OgreImageCodec.h>
 #include <OGRE/OgreVector3.h>
 
@@ -48,37 +52,101 @@
 static constexpr int kMaxBlocks = 16;
 // Max zoom level to support.
 static constexpr int kMaxZoom = 22;
+// Max prefetch horizon (s).
+static constexpr float kMaxPrefetchHorizon = 600;
+// Fixes older than this are not used to estimate the velocity (s).
+static constexpr double kMotionWindow = 5.0;
+// Shortest span of fixes a velocity is estimated from (s).
+static constexpr double kMinMotionSpan = 1.0;
+// Below this speed the robot is considered stationary (m/s).
+static constexpr double kMinPrefetchSpeed = 0.5;
+// Min time between two prefetch updates (s).
+static constexpr double kPrefetchInterval = 1.0;
+// Max number of tiles queued for prefetch at once.
+static constexpr std::size_t kMaxPrefetchTiles = 256;
+// Max number of tiles queued for prefetch along the planned path, per path
+// received.
+static constexpr std::size_t kMaxPathTiles = 2048;
+// Max tile cache size limit (MB).
+static constexpr int kMaxCacheSizeLimit = 1024 * 1024;
+// Max buffer around the planned path (m).
+static constexpr float kMaxPathBuffer = 5000;
+// Size of a tile in pixels.
+static constexpr int kTileSize = 256;
+// Length of a degree of latitude (m).
+static constexpr double kMetersPerDegree = 111319.49;
+// Prefix of the files recording the last window loaded by each display, in
+// the cache folder.
+static constexpr const char *kSessionFile = "last_session_";
+// Max number of tiles uploaded in one frame.
+static constexpr int kMaxUploadsPerFrame = 16;
 
 // TODO(gareth): If higher zooms are ever supported, change calculations from
 // int to long wherever applicable.
 static_assert((1 << kMaxZoom) < std::numeric_limits<unsigned int>::max(), "");
 
-Ogre::TexturePtr textureFromImage(const QImage &image,
-                                  const std::string &name) {
-  //  convert to 24bit rgb
-  QImage converted = image.convertToFormat(QImage::Format_RGB888).mirrored();
-
-  //  create texture
-  Ogre::TexturePtr texture;
-  Ogre::DataStreamPtr data_stream;
-  data_stream.bind(new Ogre::MemoryDataStream((void *)converted.constBits(),
-                                              converted.byteCount()));
+/// Decode the tiles of the window recorded in `session_path` into the
+/// memory cache.
+static void preloadSession(QString session_path, std::string cache_path,
+                           std::vector<std::string> base_cache_paths) {
+  QFile file(session_path);
+  if (!file.open(QIODevice::ReadOnly)) {
+    return;
+  }
+  //  one "key value" pair per line, see saveSession()
+  std::string object_uri;
+  double latitude = 0, longitude = 0;
+  int zoom = -1, blocks = 0;
+  while (!file.atEnd()) {
+    const QByteArray line = file.readLine().trimmed();
+    const int space = line.indexOf(' ');
+    if (space <= 0) {
+      continue;
+    }
+    const QByteArray key = line.left(space);
+    const QByteArray value = line.mid(space + 1);
+    if (key == "object-uri") {
+      object_uri = value.toStdString();
+    } else if (key == "latitude") {
+      latitude = value.toDouble();
+    } else if (key == "longitude") {
+      longitude = value.toDouble();
+    } else if (key == "zoom") {
+      zoom = value.toInt();
+    } else if (key == "blocks") {
+      blocks = value.toInt();
+    }
+  }
+  if (object_uri.empty() || zoom < 0 || zoom > kMaxZoom || blocks < 0 ||
+      blocks > kMaxBlocks) {
+    return;
+  }
 
-  const Ogre::String res_group =
-      Ogre::ResourceGroupManager::DEFAULT_RESOURCE_GROUP_NAME;
-  Ogre::TextureManager &texture_manager = Ogre::TextureManager::getSingleton();
-  //  swap byte order when going from QImage to Ogre
-  texture = texture_manager.loadRawData(name, res_group, data_stream,
-                                        converted.width(), converted.height(),
-                                        Ogre::PF_B8G8R8, Ogre::TEX_TYPE_2D, 0);
-  return texture;
+  try {
+    double x, y;
+    TileLoader::latLonToTileCoords(latitude, longitude, zoom, x, y);
+    //  same window as TileLoader::start()
+    const int max_tile = (1 << zoom) - 1;
+    const TileArea area(zoom, std::max(0, static_cast<int>(x) - blocks),
+                        std::max(0, static_cast<int>(y) - blocks),
+                        std::min(max_tile, static_cast<int>(x) + blocks),
+                        std::min(max_tile, static_cast<int>(y) + blocks));
+    LayeredTileCache cache(cache_path, base_cache_paths, object_uri);
+    cache.preload(area);
+    ROS_DEBUG("Preloaded the tiles around %.6f, %.6f", latitude, longitude);
+  } catch (std::exception &e) {
+    ROS_WARN("Failed to preload the last map: %s", e.what());
+  }
 }
 
 namespace rviz {
 
 AerialMapDisplay::AerialMapDisplay()
-    : Display(), map_id_(0), scene_id_(0), dirty_(false),
-      received_msg_(false) {
+    : Display(), map_id_(0), scene_id_(0), stale_node_(nullptr),
+      dirty_(false), received_msg_(false), window_loaded_(false),
+      warm_started_(false),
+      last_prefetch_stamp_(0),
+      service_(TileService::instance()) {
 
   static unsigned int map_ids = 0;
   map_id_ = map_ids++; //  global counter of map ids
@@ -103,6 +171,15 @@ AerialMapDisplay::AerialMapDisplay()
   update_nh_.param<bool>("rviz_satellite_offine_mode", rviz_satellite_offine_mode_rosparam,
                                 false);
 
+  std::string rviz_satellite_base_cache_rosparam;
+  const bool rviz_satellite_base_cache_rosparam_available =
+      update_nh_.getParam("rviz_satellite_base_cache_path",
+                          rviz_satellite_base_cache_rosparam);
+
+  int rviz_satellite_cache_size_limit_rosparam = 0;
+  update_nh_.param<int>("rviz_satellite_cache_size_limit",
+                        rviz_satellite_cache_size_limit_rosparam, 0);
+
   topic_property_ = new RosTopicProperty(
       "Topic", "", QString::fromStdString(
                        ros::message_traits::datatype<sensor_msgs::NavSatFix>()),
@@ -120,6 +197,41 @@ AerialMapDisplay::AerialMapDisplay()
   cache_path_ = cache_path_property_->getStdString();
   cache_path_property_->setHidden(!rviz_satellite_cache_rosparam_available);
 
+  base_cache_paths_property_ = new StringProperty(
+      "Base map folders",
+      QString::fromStdString(rviz_satellite_base_cache_rosparam),
+      "Read-only tile caches consulted after the map folder, separated by "
+      "':'. Tiles found there are not downloaded.",
+      this);
+  base_cache_paths_property_->setShouldBeSaved(false);
+  base_cache_paths_property_->setReadOnly(true);
+  base_cache_paths_property_->setHidden(
+      !rviz_satellite_base_cache_rosparam_available);
+  for (const QString &path :
+       base_cache_paths_property_->getString().split(':')) {
+    if (!path.isEmpty()) {
+      base_cache_paths_.push_back(path.toStdString());
+    }
+  }
+
+  cache_size_limit_property_ = new IntProperty(
+      "Cache size limit", rviz_satellite_cache_size_limit_rosparam,
+      "Max size (MB) of the cached tiles of the tile server, 0 for no limit. "
+      "The least recently used tiles are deleted first.",
+      this, SLOT(updateCacheSizeLimit()));
+  cache_size_limit_property_->setMin(0);
+  cache_size_limit_property_->setMax(kMaxCacheSizeLimit);
+  cache_size_limit_property_->setShouldBeSaved(true);
+  cache_size_limit_ = cache_size_limit_property_->getInt();
+
+  pixel_cache_property_ = new Property(
+      "Pixel cache", false,
+      "Also cache tiles decoded, so that cached tiles load without decoding. "
+      "Takes about 10 times the disk space of the tiles.",
+      this, SLOT(updatePixelCache()));
+  pixel_cache_property_->setShouldBeSaved(true);
+  pixel_cache_ = pixel_cache_property_->getValue().toBool();
+
   offline_mode_property_ = new Property("Offline mode", rviz_satellite_offine_mode_rosparam,
                                      "When enabled, there is no tile server request",
                                       this, SLOT(updateOfflineMode()));
@@ -152,6 +264,15 @@ AerialMapDisplay::AerialMapDisplay()
       "Resolution", 0, "Resolution of the map. (Read only)", this);
   resolution_property_->setReadOnly(true);
 
+  //  output, adaptive limit on tile requests in flight
+  concurrency_property_ = new IntProperty(
+      "Concurrent requests", 0,
+      "Number of tile requests allowed in flight, adapted to the observed "
+      "latency and throughput. (Read only)",
+      this);
+  concurrency_property_->setReadOnly(true);
+  concurrency_property_->setShouldBeSaved(false);
+
   //  properties for map
   proxy_uri_property_ = new StringProperty(
         "HTTP Proxy", QString(),
@@ -161,9 +282,55 @@ AerialMapDisplay::AerialMapDisplay()
 
   object_uri_property_ = new StringProperty(
       "Object URI", "http://otile1.mqcdn.com/tiles/1.0.0/sat/{z}/{x}/{y}.jpg",
-      "URL from which to retrieve map tiles.", this, SLOT(updateObjectURI()));
+      "URL from which to retrieve map tiles. A WMS GetMap URL with {bbox}, "
+      "{width} and {height} tokens loads the window in a few large images.",
+      this, SLOT(updateObjectURI()));
   object_uri_property_->setShouldBeSaved(true);
   object_uri_ = object_uri_property_->getStdString();
+  concurrency_property_->setValue(
+      service_->concurrencyController(object_uri_)->limit());
+
+  hedge_requests_property_ = new Property(
+      "Hedge slow requests", false,
+      "Send a duplicate request for tiles slower than 95% of recent requests.",
+      this, SLOT(updateHedging()));
+  hedge_requests_property_->setShouldBeSaved(true);
+  hedge_requests_ = hedge_requests_property_->getValue().toBool();
+
+  hedge_uri_property_ = new StringProperty(
+      "Hedge mirror URI", QString(),
+      "Optional mirror for duplicate requests, same format as Object URI. "
+      "Empty to use the Object URI.",
+      hedge_requests_property_, SLOT(updateHedging()), this);
+  hedge_uri_property_->setShouldBeSaved(true);
+  hedge_uri_ = hedge_uri_property_->getStdString();
+
+  prefetch_horizon_property_ = new FloatProperty(
+      "Prefetch horizon", 0,
+      "Seconds ahead along the current heading for which tiles are fetched "
+      "into the cache in the background. 0 to disable.",
+      this, SLOT(updatePrefetchHorizon()));
+  prefetch_horizon_property_->setMin(0);
+  prefetch_horizon_property_->setMax(kMaxPrefetchHorizon);
+  prefetch_horizon_property_->setShouldBeSaved(true);
+  prefetch_horizon_ = prefetch_horizon_property_->getFloat();
+
+  path_topic_property_ = new RosTopicProperty(
+      "Planned path", "",
+      QString::fromStdString(ros::message_traits::datatype<nav_msgs::Path>()),
+      "nav_msgs::Path topic. Tiles along the path are fetched into the cache "
+      "in the background, in route order.",
+      this, SLOT(updatePathTopic()));
+  path_topic_property_->setShouldBeSaved(true);
+
+  path_buffer_property_ = new FloatProperty(
+      "Path buffer", 50,
+      "Distance (m) around the planned path within which tiles are fetched.",
+      path_topic_property_, SLOT(updatePathBuffer()), this);
+  path_buffer_property_->setMin(0);
+  path_buffer_property_->setMax(kMaxPathBuffer);
+  path_buffer_property_->setShouldBeSaved(true);
+  path_buffer_ = path_buffer_property_->getFloat();
 
   const QString zoom_desc = QString::fromStdString(
       "Zoom level (0 - " + std::to_string(kMaxZoom) + ")");
@@ -182,6 +349,17 @@ AerialMapDisplay::AerialMapDisplay()
   blocks_property_->setMin(0);
   blocks_property_->setMax(kMaxBlocks);
 
+  detail_blocks_property_ = new IntProperty(
+      "Full detail blocks", kMaxBlocks,
+      "Adjacent blocks decoded at full resolution. Farther tiles are decoded "
+      "at half the resolution per further block, down to 1/8, which saves "
+      "decoding and upload time on large windows.",
+      blocks_property_, SLOT(updateDetailBlocks()), this);
+  detail_blocks_property_->setShouldBeSaved(true);
+  detail_blocks_property_->setMin(0);
+  detail_blocks_property_->setMax(kMaxBlocks);
+  detail_blocks_ = detail_blocks_property_->getInt();
+
   frame_convention_property_ =
       new EnumProperty("Frame Convention", "XYZ -> ENU",
                        "Convention for mapping cartesian frame to the compass",
@@ -200,13 +378,24 @@ AerialMapDisplay::AerialMapDisplay()
 AerialMapDisplay::~AerialMapDisplay() {
   unsubscribe();
   clear();
+  if (stale_node_) {
+    scene_manager_->destroySceneNode(stale_node_);
+  }
 }
 
 void AerialMapDisplay::onInitialize() {
   frame_property_->setFrameManager(context_->getFrameManager());
+  stale_node_ = scene_node_->createChildSceneNode();
 }
 
-void AerialMapDisplay::onEnable() { subscribe(); }
+void AerialMapDisplay::onEnable() {
+  if (!warm_started_) {
+    //  once the name and properties are loaded from the config
+    warm_started_ = true;
+    warmStart();
+  }
+  subscribe();
+}
 
 void AerialMapDisplay::onDisable() {
   unsubscribe();
@@ -232,10 +421,30 @@ void AerialMapDisplay::subscribe() {
                 QString("Error subscribing: ") + e.what());
     }
   }
+  subscribePath();
+}
+
+void AerialMapDisplay::subscribePath() {
+  path_sub_.shutdown();
+  path_.reset();
+  if (!isEnabled() || path_topic_property_->getTopic().isEmpty()) {
+    deleteStatus("Path");
+    return;
+  }
+  try {
+    path_sub_ = update_nh_.subscribe(path_topic_property_->getTopicStd(), 1,
+                                     &AerialMapDisplay::pathCallback, this);
+    setStatus(StatusProperty::Ok, "Path", "OK");
+  }
+  catch (ros::Exception &e) {
+    setStatus(StatusProperty::Error, "Path",
+              QString("Error subscribing: ") + e.what());
+  }
 }
 
 void AerialMapDisplay::unsubscribe() {
   coord_sub_.shutdown();
+  path_sub_.shutdown();
   ROS_INFO("Unsubscribing.");
 }
 
@@ -288,6 +497,43 @@ void AerialMapDisplay::updateObjectURI() {
   loadImagery(); //  reload all imagery
 }
 
+void AerialMapDisplay::updateHedging() {
+  hedge_requests_ = hedge_requests_property_->getValue().toBool();
+  hedge_uri_ = hedge_uri_property_->getStdString();
+  if (loader_) {
+    loader_->setHedging(hedge_requests_, hedge_uri_);
+  }
+}
+
+void AerialMapDisplay::updatePrefetchHorizon() {
+  prefetch_horizon_ = prefetch_horizon_property_->getFloat();
+  updatePrefetcher();
+}
+
+void AerialMapDisplay::updateCacheSizeLimit() {
+  cache_size_limit_ = cache_size_limit_property_->getInt();
+  if (loader_) {
+    loader_->setCacheSizeLimit(static_cast<qint64>(cache_size_limit_) << 20);
+  }
+}
+
+void AerialMapDisplay::updatePixelCache() {
+  pixel_cache_ = pixel_cache_property_->getValue().toBool();
+  if (loader_) {
+    loader_->setPixelCache(pixel_cache_);
+  }
+}
+
+void AerialMapDisplay::updatePathTopic() {
+  subscribePath();
+  updatePrefetcher();
+}
+
+void AerialMapDisplay::updatePathBuffer() {
+  path_buffer_ = path_buffer_property_->getFloat();
+  prefetchAlongPath();
+}
+
 void AerialMapDisplay::updateZoom() {
   const int zoom = std::max(0, std::min(kMaxZoom, zoom_property_->getInt()));
   if (zoom != zoom_) {
@@ -305,6 +551,16 @@ void AerialMapDisplay::updateBlocks() {
   }
 }
 
+void AerialMapDisplay::updateDetailBlocks() {
+  const int blocks =
+      std::max(0, std::min(kMaxBlocks, detail_blocks_property_->getInt()));
+  if (blocks != detail_blocks_) {
+    detail_blocks_ = blocks;
+    //  tiles already shown are decoded again at their new resolution
+    loadImagery();
+  }
+}
+
 void AerialMapDisplay::updateFrameConvention() {
   transformAerialMap();
 }
@@ -322,34 +578,103 @@ void AerialMapDisplay::clear() {
   received_msg_ = false;
   //  cancel current imagery, if any
   loader_.reset();
+  prefetcher_.reset();
+  fix_history_.clear();
 }
 
 void AerialMapDisplay::clearGeometry() {
-  for (MapObject &obj : objects_) {
+  clearStaleGeometry();
+  for (const auto &obj : objects_) {
     //  destroy object
-    scene_node_->detachObject(obj.object);
-    scene_manager_->destroyManualObject(obj.object);
-    //  destroy texture
-    if (!obj.texture.isNull()) {
-      Ogre::TextureManager::getSingleton().remove(obj.texture->getName());
-    }
-    //  destroy material
-    if (!obj.material.isNull()) {
-      Ogre::MaterialManager::getSingleton().remove(obj.material->getName());
-    }
+    scene_node_->detachObject(obj.second.object);
+    scene_manager_->destroyManualObject(obj.second.object);
+  }
+  objects_.clear();
+  for (const auto &material : materials_) {
+    //  destroy material, the texture goes back to the pool
+    Ogre::MaterialManager::getSingleton().remove(
+        material.second.material->getName());
+    service_->releaseTexture(material.first, !material.second.preview);
+  }
+  materials_.clear();
+}
+
+void AerialMapDisplay::keepStaleScene(const TileLoader &previous) {
+  //  only the last window is kept, e.g. if the robot moved on before the
+  //  current one loaded
+  clearStaleGeometry();
+
+  //  same tiles, placed in the frame of the new centre. The resolution
+  //  changes slightly with the latitude
+  const double scale = loader_->resolution() / previous.resolution();
+  const double tile_length = kTileSize * loader_->resolution();
+  stale_node_->setScale(scale, scale, 1.0);
+  stale_node_->setPosition(
+      (previous.centerTileX() + previous.originOffsetX() -
+       loader_->centerTileX() - loader_->originOffsetX()) *
+          tile_length,
+      (loader_->centerTileY() + loader_->originOffsetY() -
+       previous.centerTileY() - previous.originOffsetY()) *
+          tile_length,
+      0.0);
+
+  for (const auto &obj : objects_) {
+    scene_node_->detachObject(obj.second.object);
+    stale_node_->attachObject(obj.second.object);
+    //  drawn before the new tiles, so that they cover it
+    obj.second.object->setRenderQueueGroup(
+        draw_under_ ? Ogre::RENDER_QUEUE_2 : Ogre::RENDER_QUEUE_4);
+    stale_objects_.push_back(obj.second);
   }
   objects_.clear();
 }
 
+void AerialMapDisplay::clearStaleGeometry() {
+  for (const MapObject &obj : stale_objects_) {
+    stale_node_->detachObject(obj.object);
+    scene_manager_->destroyManualObject(obj.object);
+    releaseMaterial(obj.key);
+  }
+  stale_objects_.clear();
+}
+
+void AerialMapDisplay::releaseMaterial(const QByteArray &key) {
+  const auto it = materials_.find(key);
+  if (it == materials_.end() || --it->second.users > 0) {
+    return;
+  }
+  Ogre::MaterialManager::getSingleton().remove(
+      it->second.material->getName());
+  service_->releaseTexture(key, !it->second.preview);
+  materials_.erase(it);
+}
+
 void AerialMapDisplay::update(float, float) {
-  //  creates all geometry, if necessary
+  //  re-creates all geometry, if necessary
   assembleScene();
+  //  adds the tiles decoded since the last frame
+  receiveTiles();
   //  draw
   context_->queueRender();
 }
 
 void
 AerialMapDisplay::navFixCallback(const sensor_msgs::NavSatFixConstPtr &msg) {
+  //  keep a short history of fixes to estimate the motion from
+  TimedFix fix;
+  fix.stamp = msg->header.stamp.isZero() ? ros::Time::now().toSec()
+                                         : msg->header.stamp.toSec();
+  fix.latitude = msg->latitude;
+  fix.longitude = msg->longitude;
+  if (!fix_history_.empty() && fix.stamp < fix_history_.back().stamp) {
+    //  time went backwards, e.g. a bag was restarted
+    fix_history_.clear();
+  }
+  fix_history_.push_back(fix);
+  while (fix.stamp - fix_history_.front().stamp > kMotionWindow) {
+    fix_history_.pop_front();
+  }
+
   // If the new (lat,lon) falls into a different tile then we have some
   // reloading to do.
   if (!received_msg_ ||
@@ -365,14 +690,23 @@ AerialMapDisplay::navFixCallback(const sensor_msgs::NavSatFixConstPtr &msg) {
     loadImagery();
     transformAerialMap();
   }
+
+  if (fix.stamp - last_prefetch_stamp_ >= kPrefetchInterval) {
+    last_prefetch_stamp_ = fix.stamp;
+    prefetchAlongMotion();
+  }
 }
 
 void AerialMapDisplay::loadImagery() {
-  //  cancel current imagery, if any
-  loader_.reset();
+  //  cancel current imagery, if any, except for the requests the next loader
+  //  takes over
+  std::shared_ptr<TileLoader> previous;
+  previous.swap(loader_);
+  window_loaded_ = false;
   
   if (!received_msg_) {
     //  no message received from publisher
+    clearGeometry();
     return;
   }
   if (object_uri_.empty()) {
@@ -381,12 +715,36 @@ void AerialMapDisplay::loadImagery() {
   }
 
   try {
+    //  deleted on its thread, which may be handling one of its replies
     loader_.reset(new TileLoader(object_uri_, ref_fix_.latitude,
-                                 ref_fix_.longitude, zoom_, blocks_, proxy_uri_, cache_path_, offline_mode_, this));
+                                 ref_fix_.longitude, zoom_, blocks_, proxy_uri_, cache_path_,
+                                 base_cache_paths_, offline_mode_),
+                  [](TileLoader *loader) { loader->deleteLater(); });
   } catch (std::exception &e) {
+    clearGeometry();
     setStatus(StatusProperty::Error, "Message", QString(e.what()));
     return;
   }
+  loader_->moveToThread(service_->loaderThread());
+
+  if (previous && previous->zoom() == static_cast<unsigned int>(zoom_)) {
+    //  e.g. recentred: the previous tiles stay until covered by new ones
+    keepStaleScene(*previous);
+  } else {
+    //  other tiles, or none
+    clearGeometry();
+  }
+
+  loader_->setLatencyTracker(service_->latencyTracker(object_uri_));
+  loader_->setHedging(hedge_requests_, hedge_uri_);
+  const std::shared_ptr<ConcurrencyController> controller =
+      service_->concurrencyController(object_uri_);
+  loader_->setConcurrencyController(controller);
+  concurrency_property_->setValue(controller->limit());
+  loader_->setCacheSizeLimit(static_cast<qint64>(cache_size_limit_) << 20);
+  loader_->setPixelCache(pixel_cache_);
+  loader_->setDetailBlocks(detail_blocks_);
+  loader_->setPrevious(previous);
 
   QObject::connect(loader_.get(), SIGNAL(errorOcurred(QString)), this,
                    SLOT(errorOcurred(QString)));
@@ -394,12 +752,201 @@ void AerialMapDisplay::loadImagery() {
                    SLOT(warnOcurred(QString)));
   QObject::connect(loader_.get(), SIGNAL(finishedLoading()), this,
                    SLOT(finishedLoading()));
+  QObject::connect(loader_.get(), SIGNAL(concurrencyChanged(int)), this,
+                   SLOT(concurrencyChanged(int)));
   QObject::connect(loader_.get(), SIGNAL(initiatedRequest(QNetworkRequest)), this,
                    SLOT(initiatedRequest(QNetworkRequest)));
   QObject::connect(loader_.get(), SIGNAL(receivedImage(QNetworkRequest)), this,
                    SLOT(receivedImage(QNetworkRequest)));
+  saveSession();
   //  start loading images
   loader_->start();
+  updatePrefetcher();
+  prefetchAlongPath();
+}
+
+QString AerialMapDisplay::sessionPath() const {
+  //  the name may hold any character
+  return QDir(QString::fromStdString(cache_path_))
+      .filePath(kSessionFile +
+                QString::fromLatin1(QUrl::toPercentEncoding(getName())));
+}
+
+void AerialMapDisplay::saveSession() const {
+  if (cache_path_.empty()) {
+    return;
+  }
+  const QByteArray contents =
+      "object-uri " + QByteArray(object_uri_.c_str()) + "\n" +
+      "latitude " + QByteArray::number(ref_fix_.latitude, 'f', 9) + "\n" +
+      "longitude " + QByteArray::number(ref_fix_.longitude, 'f', 9) + "\n" +
+      "zoom " + QByteArray::number(zoom_) + "\n" +
+      "blocks " + QByteArray::number(blocks_) + "\n";
+  //  read by other instances starting up meanwhile
+  TileCache::writeAtomically(sessionPath(), contents);
+}
+
+void AerialMapDisplay::warmStart() {
+  if (cache_path_.empty()) {
+    return;
+  }
+  QtConcurrent::run(&preloadSession, sessionPath(), cache_path_,
+                    base_cache_paths_);
+}
+
+void AerialMapDisplay::updatePrefetcher() {
+  const bool wanted = prefetch_horizon_ > 0 ||
+                      !path_topic_property_->getTopic().isEmpty();
+  if (offline_mode_ || !wanted || object_uri_.empty()) {
+    prefetcher_.reset();
+    return;
+  }
+  if (prefetcher_ && prefetcher_->objectURI() == object_uri_ &&
+      prefetcher_->proxyURI() == proxy_uri_ &&
+      prefetcher_->cachePath() == cache_path_ &&
+      prefetcher_->baseCachePaths() == base_cache_paths_) {
+    return;
+  }
+  try {
+    prefetcher_.reset(
+        new TilePrefetcher(object_uri_, proxy_uri_, cache_path_,
+                           base_cache_paths_, this));
+  } catch (std::exception &e) {
+    ROS_ERROR("Failed to create prefetcher: %s", e.what());
+    prefetcher_.reset();
+  }
+}
+
+void AerialMapDisplay::pathCallback(const nav_msgs::PathConstPtr &msg) {
+  path_ = msg;
+  prefetchAlongPath();
+}
+
+void AerialMapDisplay::prefetchAlongPath() {
+  if (!prefetcher_ || !loader_ || !path_) {
+    return;
+  }
+
+  //  Express the path in the map plane: metres east/north of the reference
+  //  fix, the frame the tiles are drawn in (see assembleScene).
+  const Ogre::Vector3 &map_position = scene_node_->getPosition();
+  const Ogre::Quaternion map_orientation_inv =
+      scene_node_->getOrientation().Inverse();
+  std::vector<Ogre::Vector3> points;
+  points.reserve(path_->poses.size());
+  for (const geometry_msgs::PoseStamped &pose : path_->poses) {
+    Ogre::Vector3 position;
+    Ogre::Quaternion orientation;
+    if (!context_->getFrameManager()->transform(path_->header, pose.pose,
+                                                position, orientation)) {
+      setStatus(StatusProperty::Warn, "Path",
+                "No transform from [" +
+                    QString::fromStdString(path_->header.frame_id) + "] to [" +
+                    fixed_frame_ + "]");
+      return;
+    }
+    points.push_back(map_orientation_inv * (position - map_position));
+  }
+  setStatus(StatusProperty::Ok, "Path", "OK");
+  if (points.empty()) {
+    return;
+  }
+
+  //  walk the path in steps of at most half a tile, and collect the tiles
+  //  within the buffer around each step, in route order
+  const double tile_length = kTileSize * loader_->resolution();
+  const double origin_x = loader_->centerTileX() + loader_->originOffsetX();
+  const double origin_y = loader_->centerTileY() + loader_->originOffsetY();
+  const double buffer = path_buffer_ / tile_length;
+  const double max_step = std::min<double>(0.5 * tile_length,
+                                           std::max(path_buffer_, 1.0f));
+  const int max_tile = (1 << zoom_) - 1;
+  std::vector<TileCoord> tiles;
+  std::set<TileCoord> seen;
+  for (std::size_t i = 0; i < points.size() && tiles.size() < kMaxPathTiles;
+       i++) {
+    const Ogre::Vector3 &from = (i > 0) ? points[i - 1] : points[i];
+    const Ogre::Vector3 &to = points[i];
+    const double length = std::hypot(to.x - from.x, to.y - from.y);
+    const int steps = std::max(1, static_cast<int>(std::ceil(length / max_step)));
+    for (int step = 1; step <= steps && tiles.size() < kMaxPathTiles;
+         step++) {
+      const double t = static_cast<double>(step) / steps;
+      //  flip y, tile rows grow southwards
+      const double tile_x = origin_x + (from.x + t * (to.x - from.x)) / tile_length;
+      const double tile_y = origin_y - (from.y + t * (to.y - from.y)) / tile_length;
+      const int max_y =
+          std::min(max_tile, static_cast<int>(std::floor(tile_y + buffer)));
+      const int max_x =
+          std::min(max_tile, static_cast<int>(std::floor(tile_x + buffer)));
+      for (int y = std::max(0, static_cast<int>(std::floor(tile_y - buffer)));
+           y <= max_y && tiles.size() < kMaxPathTiles; y++) {
+        for (int x = std::max(0, static_cast<int>(std::floor(tile_x - buffer)));
+             x <= max_x && tiles.size() < kMaxPathTiles; x++) {
+          const TileCoord tile(x, y, zoom_);
+          if (seen.insert(tile).second) {
+            tiles.push_back(tile);
+          }
+        }
+      }
+    }
+  }
+  ROS_DEBUG("Planned path covers %zu tiles", tiles.size());
+  prefetcher_->prefetchRoute(tiles);
+}
+
+void AerialMapDisplay::prefetchAlongMotion() {
+  if (!prefetcher_ || !loader_ || fix_history_.size() < 2) {
+    return;
+  }
+  const TimedFix &first = fix_history_.front();
+  const TimedFix &last = fix_history_.back();
+  const double span = last.stamp - first.stamp;
+  if (span < kMinMotionSpan) {
+    return;
+  }
+
+  //  velocity over the history window, in degrees/s and m/s
+  const double lat_rate = (last.latitude - first.latitude) / span;
+  const double lon_rate = (last.longitude - first.longitude) / span;
+  const double speed =
+      kMetersPerDegree *
+      std::hypot(lat_rate, lon_rate * std::cos(last.latitude * M_PI / 180));
+  if (speed < kMinPrefetchSpeed) {
+    return;
+  }
+
+  //  sample the predicted track every half tile, and collect the window of
+  //  tiles around each sample that is not loaded already
+  const double tile_length = kTileSize * loader_->resolution();
+  const double step = 0.5 * tile_length / speed;
+  const int max_tile = (1 << zoom_) - 1;
+  std::vector<TileCoord> tiles;
+  std::set<TileCoord> seen;
+  for (double t = step; t <= prefetch_horizon_ &&
+                        tiles.size() < kMaxPrefetchTiles; t += step) {
+    const double lat = last.latitude + lat_rate * t;
+    const double lon = last.longitude + lon_rate * t;
+    if (std::abs(lat) > 85.0511 || std::abs(lon) > 180) {
+      break;
+    }
+    double tile_x, tile_y;
+    TileLoader::latLonToTileCoords(lat, lon, zoom_, tile_x, tile_y);
+    const int centre_x = std::floor(tile_x);
+    const int centre_y = std::floor(tile_y);
+    for (int y = std::max(0, centre_y - blocks_);
+         y <= std::min(max_tile, centre_y + blocks_); y++) {
+      for (int x = std::max(0, centre_x - blocks_);
+           x <= std::min(max_tile, centre_x + blocks_); x++) {
+        const bool loaded = loader_->inWindow(x, y);
+        const TileCoord tile(x, y, zoom_);
+        if (!loaded && seen.insert(tile).second) {
+          tiles.push_back(tile);
+        }
+      }
+    }
+  }
+  prefetcher_->prefetch(tiles);
 }
 
 void AerialMapDisplay::assembleScene() {
@@ -407,135 +954,198 @@ void AerialMapDisplay::assembleScene() {
     return; //  nothing to update
   }
   dirty_ = false;
-  
+
+  //  restyled in place, the decoded tiles are gone once uploaded
+  for (const auto &material : materials_) {
+    configureMaterial(material.second.material);
+  }
+  for (const auto &obj : objects_) {
+    obj.second.object->setRenderQueueGroup(draw_under_
+                                               ? Ogre::RENDER_QUEUE_3
+                                               : Ogre::RENDER_QUEUE_MAIN);
+  }
+  for (const MapObject &obj : stale_objects_) {
+    obj.object->setRenderQueueGroup(draw_under_ ? Ogre::RENDER_QUEUE_2
+                                                : Ogre::RENDER_QUEUE_4);
+  }
+}
+
+void AerialMapDisplay::receiveTiles() {
   if (!loader_) {
-    return; //  no tiles loaded, don't do anything
+    return;
   }
-  
-  //  get rid of old geometry, we will re-build this
-  clearGeometry();
-  
-  //  iterate over all tiles and create an object for each of them
-  for (const TileLoader::MapTile &tile : loader_->tiles()) {
-    // NOTE(gareth): We invert the y-axis so that positive y corresponds
-    // to north. We are in XYZ->ENU convention here.
-    const int w = tile.image().width();
-    const int h = tile.image().height();
-    const double tile_w = w * loader_->resolution();
-    const double tile_h = h * loader_->resolution();
-
-    // Shift back such that (0, 0) corresponds to the exact latitude and
-    // longitude the tile loader requested.
-    // This is the local origin, in the frame of the map node.
-    const double origin_x = -loader_->originOffsetX() * tile_w;
-    const double origin_y = -(1 - loader_->originOffsetY()) * tile_h;
-
-    // determine location of this tile, flipping y in the process
-    const double x = (tile.x() - loader_->centerTileX()) * tile_w + origin_x;
-    const double y = -(tile.y() - loader_->centerTileY()) * tile_h + origin_y;
-    //  don't re-use any ids
-    const std::string name_suffix =
-        std::to_string(tile.x()) + "_" + std::to_string(tile.y()) + "_" +
-        std::to_string(map_id_) + "_" + std::to_string(scene_id_);
-
-    if (tile.hasImage()) {
-      //  one material per texture
-      Ogre::MaterialPtr material = Ogre::MaterialManager::getSingleton().create(
-          "material_" + name_suffix,
-          Ogre::ResourceGroupManager::DEFAULT_RESOURCE_GROUP_NAME);
-      material->setReceiveShadows(false);
-      material->getTechnique(0)->setLightingEnabled(false);
-      material->setDepthBias(-16.0f, 0.0f);
-      material->setCullingMode(Ogre::CULL_NONE);
-      material->setDepthWriteEnabled(false);
-
-      //  create textureing unit
-      Ogre::Pass *pass = material->getTechnique(0)->getPass(0);
-      Ogre::TextureUnitState *tex_unit = nullptr;
-      if (pass->getNumTextureUnitStates() > 0) {
-        tex_unit = pass->getTextureUnitState(0);
-      } else {
-        tex_unit = pass->createTextureUnitState();
-      }
+  //  a few per frame keeps frames short, the loader stops decoding while
+  //  the queue is full
+  TileLoader::DecodedTile tile;
+  for (int uploads = 0;
+       uploads < kMaxUploadsPerFrame && loader_->output()->pop(tile);
+       uploads++) {
+    const auto shown = objects_.find(TileCoord(tile.x, tile.y, zoom_));
+    if (tile.preview && shown != objects_.end() && !shown->second.preview) {
+      continue; //  the whole tile got ahead of its preview
+    }
+    //  a newer version or a finer preview replaces the tile
+    addTile(tile);
+  }
+  if (window_loaded_ && loader_->output()->idle()) {
+    //  all tiles of the window are shown, the previous one is covered
+    clearStaleGeometry();
+  }
+}
 
-      //  only add if we have a texture for it
-      Ogre::TexturePtr texture =
-          textureFromImage(tile.image(), "texture_" + name_suffix);
-
-      tex_unit->setTextureName(texture->getName());
-      tex_unit->setTextureFiltering(Ogre::TFO_BILINEAR);
-
-      //  create an object
-      const std::string obj_name = "object_" + name_suffix;
-      Ogre::ManualObject *obj = scene_manager_->createManualObject(obj_name);
-      scene_node_->attachObject(obj);
-
-      //  configure depth & alpha properties
-      if (alpha_ >= 0.9998) {
-        material->setDepthWriteEnabled(!draw_under_);
-        material->setSceneBlending(Ogre::SBT_REPLACE);
-      } else {
-        material->setSceneBlending(Ogre::SBT_TRANSPARENT_ALPHA);
-        material->setDepthWriteEnabled(false);
-      }
+void AerialMapDisplay::addTile(const TileLoader::DecodedTile &tile) {
+  //  e.g. a preview refined. Its material is released once this tile has
+  //  taken its own, in case they are the same
+  QByteArray previous_key;
+  bool replaced = false;
+  const auto previous = objects_.find(TileCoord(tile.x, tile.y, zoom_));
+  if (previous != objects_.end()) {
+    scene_node_->detachObject(previous->second.object);
+    scene_manager_->destroyManualObject(previous->second.object);
+    previous_key = previous->second.key;
+    replaced = true;
+    objects_.erase(previous);
+  }
 
-      if (draw_under_) {
-        obj->setRenderQueueGroup(Ogre::RENDER_QUEUE_3);
-      } else {
-        obj->setRenderQueueGroup(Ogre::RENDER_QUEUE_MAIN);
-      }
+  // NOTE(gareth): We invert the y-axis so that positive y corresponds
+  // to north. We are in XYZ->ENU convention here.
+  const int w = tile.width();
+  const int h = tile.height();
+  const double tile_w = w * tile.scale * loader_->resolution();
+  const double tile_h = h * tile.scale * loader_->resolution();
+
+  // Shift back such that (0, 0) corresponds to the exact latitude and
+  // longitude the tile loader requested.
+  // This is the local origin, in the frame of the map node.
+  const double origin_x = -loader_->originOffsetX() * tile_w;
+  const double origin_y = -(1 - loader_->originOffsetY()) * tile_h;
+
+  // determine location of this tile, flipping y in the process
+  const double x = (tile.x - loader_->centerTileX()) * tile_w + origin_x;
+  const double y = -(tile.y - loader_->centerTileY()) * tile_h + origin_y;
+  //  don't re-use any ids
+  const std::string name_suffix =
+      std::to_string(tile.x) + "_" + std::to_string(tile.y) + "_" +
+      std::to_string(map_id_) + "_" + std::to_string(scene_id_++);
+
+  //  identical tiles, e.g. open sea, are uploaded once, also across
+  //  displays and reloads
+  QByteArray key = tile.checksum.isEmpty() ? QByteArray(name_suffix.c_str())
+                                           : tile.checksum;
+  if (tile.scale > 1 && !tile.checksum.isEmpty()) {
+    //  not the texture of the tile at full resolution
+    key += "/" + QByteArray::number(tile.scale);
+  }
+  Ogre::MaterialPtr material;
+  const auto it = materials_.find(key);
+  if (it != materials_.end()) {
+    material = it->second.material;
+    it->second.users++;
+  } else {
+    //  one material per texture
+    material = Ogre::MaterialManager::getSingleton().create(
+        "material_" + name_suffix,
+        Ogre::ResourceGroupManager::DEFAULT_RESOURCE_GROUP_NAME);
+    material->setReceiveShadows(false);
+    material->getTechnique(0)->setLightingEnabled(false);
+    material->setDepthBias(-16.0f, 0.0f);
+    material->setCullingMode(Ogre::CULL_NONE);
+    material->setDepthWriteEnabled(false);
+
+    //  create textureing unit
+    Ogre::Pass *pass = material->getTechnique(0)->getPass(0);
+    Ogre::TextureUnitState *tex_unit = nullptr;
+    if (pass->getNumTextureUnitStates() > 0) {
+      tex_unit = pass->getTextureUnitState(0);
+    } else {
+      tex_unit = pass->createTextureUnitState();
+    }
 
-      tex_unit->setAlphaOperation(Ogre::LBX_SOURCE1, Ogre::LBS_MANUAL,
-                                  Ogre::LBS_CURRENT, alpha_);
+    const Ogre::TexturePtr texture = service_->acquireTexture(key, tile);
+    tex_unit->setTextureName(texture->getName());
+    tex_unit->setTextureFiltering(Ogre::TFO_BILINEAR);
+    configureMaterial(material);
 
-      //  create a quad for this tile
-      obj->begin(material->getName(), Ogre::RenderOperation::OT_TRIANGLE_LIST);
+    TileMaterial &entry = materials_[key];
+    entry.material = material;
+    entry.users = 1;
+    entry.preview = tile.preview;
+  }
 
-      //  bottom left
-      obj->position(x, y, 0.0f);
-      obj->textureCoord(0.0f, 0.0f);
-      obj->normal(0.0f, 0.0f, 1.0f);
+  //  create an object
+  const std::string obj_name = "object_" + name_suffix;
+  Ogre::ManualObject *obj = scene_manager_->createManualObject(obj_name);
+  scene_node_->attachObject(obj);
 
-      // top right
-      obj->position(x + tile_w, y + tile_h, 0.0f);
-      obj->textureCoord(1.0f, 1.0f);
-      obj->normal(0.0f, 0.0f, 1.0f);
+  if (draw_under_) {
+    obj->setRenderQueueGroup(Ogre::RENDER_QUEUE_3);
+  } else {
+    obj->setRenderQueueGroup(Ogre::RENDER_QUEUE_MAIN);
+  }
 
-      // top left
-      obj->position(x, y + tile_h, 0.0f);
-      obj->textureCoord(0.0f, 1.0f);
-      obj->normal(0.0f, 0.0f, 1.0f);
+  //  create a quad for this tile
+  obj->begin(material->getName(), Ogre::RenderOperation::OT_TRIANGLE_LIST);
 
-      //  bottom left
-      obj->position(x, y, 0.0f);
-      obj->textureCoord(0.0f, 0.0f);
-      obj->normal(0.0f, 0.0f, 1.0f);
+  //  bottom left
+  obj->position(x, y, 0.0f);
+  obj->textureCoord(0.0f, 0.0f);
+  obj->normal(0.0f, 0.0f, 1.0f);
 
-      // bottom right
-      obj->position(x + tile_w, y, 0.0f);
-      obj->textureCoord(1.0f, 0.0f);
-      obj->normal(0.0f, 0.0f, 1.0f);
+  // top right
+  obj->position(x + tile_w, y + tile_h, 0.0f);
+  obj->textureCoord(1.0f, 1.0f);
+  obj->normal(0.0f, 0.0f, 1.0f);
 
-      // top right
-      obj->position(x + tile_w, y + tile_h, 0.0f);
-      obj->textureCoord(1.0f, 1.0f);
-      obj->normal(0.0f, 0.0f, 1.0f);
+  // top left
+  obj->position(x, y + tile_h, 0.0f);
+  obj->textureCoord(0.0f, 1.0f);
+  obj->normal(0.0f, 0.0f, 1.0f);
 
-      obj->end();
+  //  bottom left
+  obj->position(x, y, 0.0f);
+  obj->textureCoord(0.0f, 0.0f);
+  obj->normal(0.0f, 0.0f, 1.0f);
 
-      if (draw_under_property_->getValue().toBool()) {
-        //  render under everything else
-        obj->setRenderQueueGroup(Ogre::RENDER_QUEUE_3);
-      }
+  // bottom right
+  obj->position(x + tile_w, y, 0.0f);
+  obj->textureCoord(1.0f, 0.0f);
+  obj->normal(0.0f, 0.0f, 1.0f);
 
-      MapObject object;
-      object.object = obj;
-      object.texture = texture;
-      object.material = material;
-      objects_.push_back(object);
-    }
+  // top right
+  obj->position(x + tile_w, y + tile_h, 0.0f);
+  obj->textureCoord(1.0f, 1.0f);
+  obj->normal(0.0f, 0.0f, 1.0f);
+
+  obj->end();
+
+  if (draw_under_property_->getValue().toBool()) {
+    //  render under everything else
+    obj->setRenderQueueGroup(Ogre::RENDER_QUEUE_3);
+  }
+
+  MapObject &entry = objects_[TileCoord(tile.x, tile.y, zoom_)];
+  entry.object = obj;
+  entry.key = key;
+  entry.preview = tile.preview;
+  if (replaced) {
+    releaseMaterial(previous_key);
   }
-  scene_id_++;
+}
+
+void AerialMapDisplay::configureMaterial(const Ogre::MaterialPtr &material) {
+  //  configure depth & alpha properties
+  if (alpha_ >= 0.9998) {
+    material->setDepthWriteEnabled(!draw_under_);
+    material->setSceneBlending(Ogre::SBT_REPLACE);
+  } else {
+    material->setSceneBlending(Ogre::SBT_TRANSPARENT_ALPHA);
+    material->setDepthWriteEnabled(false);
+  }
+
+  Ogre::TextureUnitState *tex_unit =
+      material->getTechnique(0)->getPass(0)->getTextureUnitState(0);
+  tex_unit->setAlphaOperation(Ogre::LBX_SOURCE1, Ogre::LBS_MANUAL,
+                              Ogre::LBS_CURRENT, alpha_);
 }
 
 void AerialMapDisplay::initiatedRequest(QNetworkRequest request) {
@@ -547,8 +1157,12 @@ void AerialMapDisplay::receivedImage(QNetworkRequest request) {
 }
 
 void AerialMapDisplay::finishedLoading() {
+  if (sender() != loader_.get()) {
+    //  queued before the loader was replaced
+    return;
+  }
+  window_loaded_ = true;
   ROS_INFO("Finished loading all tiles.");
-  dirty_ = true;
   setStatus(StatusProperty::Ok, "Message", "Loaded all tiles.");
   //  set property for resolution display
   if (loader_) {
@@ -556,6 +1170,10 @@ void AerialMapDisplay::finishedLoading() {
   }
 }
 
+void AerialMapDisplay::concurrencyChanged(int limit) {
+  concurrency_property_->setValue(limit);
+}
+
 void AerialMapDisplay::errorOcurred(QString description) {
   ROS_ERROR("Error: %s", qPrintable(description));
   setStatus(StatusProperty::Error, "Message", description);
@@ -17,6 +17,7 @@
 #include <ros/time.h>
 #include <rviz/display.h>
 #include <sensor_msgs/NavSatFix.h>
+#include <nav_msgs/Path.h>
 
 #include <OGRE/OgreTexture.h>
 #include <OGRE/OgreMaterial.h>
@@ -29,8 +30,15 @@
 #include <QFile>
 #include <QNetworkRequest>
 
+#include <deque>
+#include <map>
 #include <memory>
+#include <vector>
 #include <tileloader.h>
+#include <tileprefetcher.h>
+#include <tile_service.h>
+#include <latency_tracker.h>
+#include <concurrency_controller.h>
 
 namespace Ogre {
 class ManualObject;
@@ -72,9 +80,16 @@ protected Q_SLOTS:
   void updateProxyURI();
   void updateZoom();
   void updateBlocks();
+  void updateDetailBlocks();
   void updateFrameConvention();
   void updateCacheFolder();
   void updateOfflineMode();
+  void updateCacheSizeLimit();
+  void updatePixelCache();
+  void updateHedging();
+  void updatePrefetchHorizon();
+  void updatePathTopic();
+  void updatePathBuffer();
 
   //  slots for TileLoader messages
   void initiatedRequest(QNetworkRequest request);
@@ -82,6 +97,7 @@ protected Q_SLOTS:
   void finishedLoading();
   void errorOcurred(QString description);
   void warnOcurred(QString description);
+  void concurrencyChanged(int limit);
 
 protected:
   // overrides from Display
@@ -93,45 +109,123 @@ protected:
 
   void navFixCallback(const sensor_msgs::NavSatFixConstPtr &msg);
 
+  void pathCallback(const nav_msgs::PathConstPtr &msg);
+
+  void subscribePath();
+
   void loadImagery();
 
+  /// File recording the last window loaded by this display.
+  QString sessionPath() const;
+
+  /// Record the window being loaded, for warmStart() in the next session.
+  void saveSession() const;
+
+  /// Decode the tiles of the window of the last session into memory in the
+  /// background, in case the first fix is at the same place.
+  void warmStart();
+
+  /// (Re)create the prefetcher if the tile source changed.
+  void updatePrefetcher();
+
+  /// Prefetch the tiles the robot is predicted to enter.
+  void prefetchAlongMotion();
+
+  /// Prefetch the tiles within the buffer around the planned path.
+  void prefetchAlongPath();
+
+  /// Apply the alpha and draw order to the tiles shown, if dirty.
   void assembleScene();
 
+  /// Add the tiles the loader decoded since the last frame, a batch at a
+  /// time.
+  void receiveTiles();
+
+  /// Create the object of `tile`, replacing the previous one if any.
+  void addTile(const TileLoader::DecodedTile &tile);
+
+  /// Apply the alpha and draw order to `material`.
+  void configureMaterial(const Ogre::MaterialPtr &material);
+
   void clear();
   
   void clearGeometry();
 
+  /// Keep the objects of `previous`, a loader of the same zoom, in place
+  /// under the new window until it has loaded.
+  void keepStaleScene(const TileLoader &previous);
+
+  /// Destroy the objects kept by keepStaleScene().
+  void clearStaleGeometry();
+
+  /// Drop a use of the material with texture key `key`, destroying it and
+  /// returning the texture to the pool after the last.
+  void releaseMaterial(const QByteArray &key);
+
   void transformAerialMap();
 
   unsigned int map_id_;
   unsigned int scene_id_;
 
-  /// Instance of a tile w/ associated ogre data
   struct MapObject {
     Ogre::ManualObject *object;
-    Ogre::TexturePtr texture;
+    /// Key of its material
+    QByteArray key;
+    /// Showing a preview, to be replaced by the tile
+    bool preview;
+  };
+
+  struct TileMaterial {
     Ogre::MaterialPtr material;
+    /// Number of objects using it
+    int users;
+    /// Its texture is of a preview, not worth keeping once unused
+    bool preview;
   };
-  std::vector<MapObject> objects_;
+
+  /// Object of each tile shown
+  std::map<TileCoord, MapObject> objects_;
+  /// Materials of the textures taken from the service, by texture key
+  /// (the tile checksum, if known)
+  std::map<QByteArray, TileMaterial> materials_;
+  /// Objects of the previous window, shown under the current one until it
+  /// has loaded
+  std::vector<MapObject> stale_objects_;
+  /// Node of the stale objects, placing them relative to the current centre
+  Ogre::SceneNode *stale_node_;
 
   ros::Subscriber coord_sub_;
+  ros::Subscriber path_sub_;
 
   //  properties
   RosTopicProperty *topic_property_;
   TfFrameProperty *frame_property_;
   Property *offline_mode_property_ ;
   StringProperty *cache_path_property_;
+  IntProperty *cache_size_limit_property_;
+  Property *pixel_cache_property_;
+  StringProperty *base_cache_paths_property_;
   Property *dynamic_reload_property_;
   StringProperty *object_uri_property_;
   StringProperty *proxy_uri_property_;
   IntProperty *zoom_property_;
   IntProperty *blocks_property_;
+  IntProperty *detail_blocks_property_;
   FloatProperty *resolution_property_;
+  IntProperty *concurrency_property_;
   FloatProperty *alpha_property_;
   Property *draw_under_property_;
   EnumProperty * frame_convention_property_;
+  Property *hedge_requests_property_;
+  StringProperty *hedge_uri_property_;
+  FloatProperty *prefetch_horizon_property_;
+  RosTopicProperty *path_topic_property_;
+  FloatProperty *path_buffer_property_;
 
   std::string cache_path_;
+  std::vector<std::string> base_cache_paths_;
+  int cache_size_limit_;
+  bool pixel_cache_;
   bool offline_mode_;
   float alpha_;
   bool draw_under_;
@@ -139,12 +233,36 @@ protected:
   std::string proxy_uri_;
   int zoom_;
   int blocks_;
+  int detail_blocks_;
+  bool hedge_requests_;
+  std::string hedge_uri_;
+  float prefetch_horizon_;
+  float path_buffer_;
 
   //  tile management
   bool dirty_;
   bool received_msg_;
+  /// Has the current loader downloaded all its tiles?
+  bool window_loaded_;
+  /// Was warmStart() run?
+  bool warm_started_;
   sensor_msgs::NavSatFix ref_fix_;
   std::shared_ptr<TileLoader> loader_;
+
+  //  motion prediction
+  struct TimedFix {
+    double stamp;
+    double latitude;
+    double longitude;
+  };
+  std::deque<TimedFix> fix_history_;
+  double last_prefetch_stamp_;
+  std::shared_ptr<TilePrefetcher> prefetcher_;
+  /// Last planned path received, if any
+  nav_msgs::PathConstPtr path_;
+  /// Loader thread, request statistics and textures shared with the other
+  /// displays
+  std::shared_ptr<TileService> service_;
 };
 
 } // namespace rviz
@@ -0,0 +1,97 @@
+/*
+ * ConcurrencyController.cpp
+ *
+ *  Copyright (c) 2014 Gaeth Cross. Apache 2 License.
+ *
+ *  This file is part of rviz_satellite.
+ *
+ *	Created on: 16/10/2026
+ */
+
+#include "concurrency_controller.h"
+
+#include <algorithm>
+#include <cassert>
+
+// Weight of a new sample in the recent latency average.
+static constexpr double kRecentLatencyWeight = 0.2;
+// Per-sample upward drift of the baseline, so it can follow route changes.
+static constexpr double kBaselineDrift = 0.002;
+// Below this latency gradient the limit is reduced.
+static constexpr double kGradientTolerance = 0.8;
+// Lower bound on the gradient, i.e. the largest single reduction.
+static constexpr double kMinGradient = 0.5;
+// Multiplicative decrease applied on errors.
+static constexpr double kErrorBackoff = 0.5;
+// Throughput may drop by this fraction before growth is held back.
+static constexpr double kThroughputSlack = 0.05;
+
+ConcurrencyController::ConcurrencyController(int initial_limit, int min_limit,
+                                             int max_limit)
+    : limit_(initial_limit), min_limit_(min_limit), max_limit_(max_limit),
+      baseline_latency_(0), recent_latency_(0), round_samples_(0),
+      round_had_error_(false), round_bytes_(0), round_start_(Clock::now()),
+      last_throughput_(0) {
+  assert(min_limit_ >= 1 && min_limit_ <= max_limit_);
+  limit_ = std::max<double>(min_limit_, std::min<double>(max_limit_, limit_));
+}
+
+int ConcurrencyController::limit() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return static_cast<int>(limit_);
+}
+
+void ConcurrencyController::onSuccess(double latency_ms, std::int64_t bytes) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  latency_ms = std::max(1.0, latency_ms);
+  if (baseline_latency_ <= 0) {
+    baseline_latency_ = latency_ms;
+    recent_latency_ = latency_ms;
+  } else {
+    baseline_latency_ =
+        std::min(baseline_latency_ * (1 + kBaselineDrift), latency_ms);
+    recent_latency_ = (1 - kRecentLatencyWeight) * recent_latency_ +
+                      kRecentLatencyWeight * latency_ms;
+  }
+  round_bytes_ += bytes;
+  if (++round_samples_ >= static_cast<int>(limit_)) {
+    endRound();
+  }
+}
+
+void ConcurrencyController::onError() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!round_had_error_) {
+    //  back off once per round, a burst of errors is one congestion event
+    limit_ = std::max<double>(min_limit_, limit_ * kErrorBackoff);
+    round_had_error_ = true;
+  }
+  if (++round_samples_ >= static_cast<int>(limit_)) {
+    endRound();
+  }
+}
+
+void ConcurrencyController::endRound() {
+  const double seconds =
+      std::chrono::duration<double>(Clock::now() - round_start_).count();
+  const double throughput = seconds > 0 ? round_bytes_ / seconds : 0;
+
+  if (!round_had_error_ && recent_latency_ > 0) {
+    const double gradient = std::max(
+        kMinGradient, std::min(1.0, baseline_latency_ / recent_latency_));
+    if (gradient < kGradientTolerance) {
+      //  queueing somewhere on the path, shrink with the latency increase
+      limit_ *= gradient;
+    } else if (throughput >= (1 - kThroughputSlack) * last_throughput_) {
+      //  latency is flat and we are not losing throughput: probe upwards
+      limit_ += 1;
+    }
+  }
+  limit_ = std::max<double>(min_limit_, std::min<double>(max_limit_, limit_));
+
+  last_throughput_ = throughput;
+  round_samples_ = 0;
+  round_had_error_ = false;
+  round_bytes_ = 0;
+  round_start_ = Clock::now();
+}
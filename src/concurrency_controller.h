@@ -0,0 +1,65 @@
+/*
+ * ConcurrencyController.h
+ *
+ *  Copyright (c) 2014 Gaeth Cross. Apache 2 License.
+ *
+ *  This file is part of rviz_satellite.
+ *
+ *	Created on: 16/10/2026
+ */
+
+#ifndef CONCURRENCY_CONTROLLER_H
+#define CONCURRENCY_CONTROLLER_H
+
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+
+/**
+ * @class ConcurrencyController
+ * @brief Adapts the number of tile requests allowed in flight.
+ *
+ * The limit is revised once per "round" (as many completed requests as the
+ * current limit). The ratio of the baseline (minimum) latency to the recent
+ * average latency is used as a gradient: when latency rises the limit shrinks
+ * proportionally, when it is flat and throughput did not drop the limit grows
+ * by one. Errors halve the limit, at most once per round.
+ *
+ * Shared between successive TileLoader instances. All methods are thread safe.
+ */
+class ConcurrencyController {
+public:
+  explicit ConcurrencyController(int initial_limit = 6, int min_limit = 1,
+                                 int max_limit = 32);
+
+  /// Number of requests currently allowed in flight.
+  int limit() const;
+
+  /// Report a successful request with its latency and payload size.
+  void onSuccess(double latency_ms, std::int64_t bytes);
+
+  /// Report a request that failed in a way that suggests congestion.
+  void onError();
+
+private:
+  typedef std::chrono::steady_clock Clock;
+
+  /// Revise the limit at the end of a round. Requires mutex_ held.
+  void endRound();
+
+  mutable std::mutex mutex_;
+  double limit_;
+  const int min_limit_;
+  const int max_limit_;
+
+  double baseline_latency_;
+  double recent_latency_;
+
+  int round_samples_;
+  bool round_had_error_;
+  std::int64_t round_bytes_;
+  Clock::time_point round_start_;
+  double last_throughput_;
+};
+
+#endif // CONCURRENCY_CONTROLLER_H
@@ -0,0 +1,180 @@
+/*
+ * decode_benchmark.cpp
+ *
+ *  Copyright (c) 2014 Gaeth Cross. Apache 2 License.
+ *
+ *  This file is part of rviz_satellite.
+ *
+ *	Created on: 16/10/2026
+ */
+
+/*
+ * rviz_satellite_decode_benchmark: time the decoding of tiles, from files or
+ * a cache folder, with the decoder of the display against plain Qt. Run
+ * without arguments for usage.
+ */
+
+#include <QBuffer>
+#include <QByteArray>
+#include <QCoreApplication>
+#include <QDirIterator>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QImage>
+#include <QImageReader>
+#include <QString>
+#include <QStringList>
+#include <cstdio>
+#include <vector>
+
+#include "tilecache.h"
+
+// Default number of times each tile is decoded.
+static constexpr int kDefaultRuns = 5;
+
+static void printUsage() {
+  std::fprintf(
+      stderr,
+      "Usage: rviz_satellite_decode_benchmark [--runs N] [--scale S] "
+      "PATH...\n"
+      "\n"
+      "Decodes the tiles found at each PATH, a tile or a folder such as a "
+      "cache folder,\n"
+      "as the display does and as plain Qt does, and prints the average time "
+      "per tile.\n"
+      "Both include the conversion to the layout uploaded to the GPU.\n"
+      "\n"
+      "  --runs N     Times each tile is decoded (default: %d)\n"
+      "  --scale S    Decode at 1/S of the size, 1, 2, 4 or 8 (default: 1)\n",
+      kDefaultRuns);
+}
+
+/// Read the tiles at `path` into `tiles`.
+static void readTiles(const QString &path, std::vector<QByteArray> &tiles) {
+  QStringList files;
+  if (QFileInfo(path).isDir()) {
+    //  pixel files, metadata and blobs are not tiles
+    QDirIterator it(path, QStringList() << "*.jpg" << "*.jpeg" << "*.png",
+                    QDir::Files, QDirIterator::Subdirectories);
+    while (it.hasNext()) {
+      files << it.next();
+    }
+  } else {
+    files << path;
+  }
+  for (const QString &name : files) {
+    QFile file(name);
+    if (file.open(QIODevice::ReadOnly)) {
+      tiles.push_back(file.readAll());
+    }
+  }
+}
+
+/// Decode `data` the way the display does without libjpeg-turbo.
+static QImage decodeWithQt(const QByteArray &data, int scale) {
+  QBuffer buffer;
+  buffer.setData(data);
+  QImageReader reader(&buffer);
+  if (scale > 1) {
+    const QSize size = reader.size();
+    if (size.isValid()) {
+      reader.setScaledSize(QSize(size.width() / scale, size.height() / scale));
+    }
+  }
+  return reader.read();
+}
+
+/// Average time (us) to decode a tile of `tiles` with `decode`, and convert
+/// it for upload. The number of tiles that failed to decode is written to
+/// `failed`.
+static double timeDecoding(QImage (*decode)(const QByteArray &, int),
+                           const std::vector<QByteArray> &tiles, int runs,
+                           int scale, int &failed) {
+  failed = 0;
+  QElapsedTimer timer;
+  timer.start();
+  for (int run = 0; run < runs; run++) {
+    for (const QByteArray &data : tiles) {
+      const QImage image = decode(data, scale);
+      if (image.isNull()) {
+        failed++;
+        continue;
+      }
+      //  as for textureFromImage(), free if decoded for upload already
+      const QImage converted = TileCache::toUploadLayout(image);
+      (void)converted;
+    }
+  }
+  return timer.nsecsElapsed() / 1000.0 / (static_cast<double>(runs) *
+                                          tiles.size());
+}
+
+int main(int argc, char **argv) {
+  QCoreApplication app(argc, argv);
+
+  int runs = kDefaultRuns;
+  int scale = 1;
+  std::vector<QByteArray> tiles;
+
+  const QStringList args = QCoreApplication::arguments();
+  for (int i = 1; i < args.size(); i++) {
+    const QString &arg = args[i];
+    if (!arg.startsWith("--")) {
+      readTiles(arg, tiles);
+      continue;
+    }
+    if (i + 1 >= args.size()) {
+      printUsage();
+      return 1;
+    }
+    const QString value = args[++i];
+    bool ok = false;
+    if (arg == "--runs") {
+      runs = value.toInt(&ok);
+      ok = ok && runs > 0;
+    } else if (arg == "--scale") {
+      scale = value.toInt(&ok);
+      ok = ok && (scale == 1 || scale == 2 || scale == 4 || scale == 8);
+    }
+    if (!ok) {
+      std::fprintf(stderr, "Invalid argument: %s %s\n", qPrintable(arg),
+                   qPrintable(value));
+      printUsage();
+      return 1;
+    }
+  }
+  if (tiles.empty()) {
+    printUsage();
+    return 1;
+  }
+
+  //  once untimed, so that both start with plugins loaded and caches warm
+  int qt_failed = 0;
+  int tiles_failed = 0;
+  timeDecoding(&decodeWithQt, tiles, 1, scale, qt_failed);
+  timeDecoding(&TileCache::decodeForUpload, tiles, 1, scale, tiles_failed);
+
+  const double qt_us =
+      timeDecoding(&decodeWithQt, tiles, runs, scale, qt_failed);
+  const double tiles_us = timeDecoding(&TileCache::decodeForUpload, tiles,
+                                       runs, scale, tiles_failed);
+#ifdef RVIZ_SATELLITE_TURBOJPEG
+  const char *backend = "libjpeg-turbo";
+#else
+  const char *backend = "Qt, built without libjpeg-turbo";
+#endif
+  std::printf("%zu tiles, %d runs, scale 1/%d\n", tiles.size(), runs, scale);
+  std::printf("Qt:            %8.1f us/tile\n", qt_us);
+  std::printf("rviz_satellite: %7.1f us/tile (%s), %.2fx\n", tiles_us,
+              backend, qt_us / tiles_us);
+  //  the decoders may disagree, e.g. on truncated files
+  if (qt_failed > 0) {
+    std::printf("%d tiles could not be decoded by Qt\n", qt_failed / runs);
+  }
+  if (tiles_failed > 0) {
+    std::printf("%d tiles could not be decoded by rviz_satellite\n",
+                tiles_failed / runs);
+  }
+  return 0;
+}
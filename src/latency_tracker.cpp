@@ -0,0 +1,52 @@
+/*
+ * LatencyTracker.cpp
+ *
+ *  Copyright (c) 2014 Gaeth Cross. Apache 2 License.
+ *
+ *  This file is part of rviz_satellite.
+ *
+ *	Created on: 16/10/2026
+ */
+
+#include "latency_tracker.h"
+
+#include <algorithm>
+#include <cassert>
+
+LatencyTracker::LatencyTracker(std::size_t capacity)
+    : capacity_(capacity), next_(0) {
+  assert(capacity_ > 0);
+  samples_.reserve(capacity_);
+}
+
+void LatencyTracker::addSample(double latency_ms) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (samples_.size() < capacity_) {
+    samples_.push_back(latency_ms);
+  } else {
+    //  overwrite the oldest sample
+    samples_[next_] = latency_ms;
+  }
+  next_ = (next_ + 1) % capacity_;
+}
+
+double LatencyTracker::percentile(double p) const {
+  std::vector<double> sorted;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    sorted = samples_;
+  }
+  if (sorted.empty()) {
+    return 0;
+  }
+  p = std::max(0.0, std::min(1.0, p));
+  const std::size_t rank =
+      static_cast<std::size_t>(p * (sorted.size() - 1) + 0.5);
+  std::nth_element(sorted.begin(), sorted.begin() + rank, sorted.end());
+  return sorted[rank];
+}
+
+std::size_t LatencyTracker::size() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return samples_.size();
+}
@@ -0,0 +1,45 @@
+/*
+ * LatencyTracker.h
+ *
+ *  Copyright (c) 2014 Gaeth Cross. Apache 2 License.
+ *
+ *  This file is part of rviz_satellite.
+ *
+ *	Created on: 16/10/2026
+ */
+
+#ifndef LATENCY_TRACKER_H
+#define LATENCY_TRACKER_H
+
+#include <cstddef>
+#include <mutex>
+#include <vector>
+
+/**
+ * @class LatencyTracker
+ * @brief Keeps a window of recent request latencies, for percentile queries.
+ *
+ * Shared between successive TileLoader instances so that the history survives
+ * reloads. All methods are thread safe.
+ */
+class LatencyTracker {
+public:
+  explicit LatencyTracker(std::size_t capacity = 128);
+
+  /// Record the latency of a completed request, in milliseconds.
+  void addSample(double latency_ms);
+
+  /// Latency (ms) at percentile p in [0, 1]. Zero if there are no samples.
+  double percentile(double p) const;
+
+  /// Number of samples currently in the window.
+  std::size_t size() const;
+
+private:
+  mutable std::mutex mutex_;
+  std::vector<double> samples_;
+  std::size_t capacity_;
+  std::size_t next_;
+};
+
+#endif // LATENCY_TRACKER_H
@@ -0,0 +1,283 @@
+/*
+ * LayeredTileCache.cpp
+ *
+ *  Copyright (c) 2014 Gaeth Cross. Apache 2 License.
+ *
+ *  This file is part of rviz_satellite.
+ *
+ *	Created on: 16/10/2026
+ */
+
+#include "layered_tilecache.h"
+
+#include <algorithm>
+#include <list>
+#include <map>
+#include <mutex>
+
+// Default size of the decoded tiles kept in memory, for the whole process
+// (bytes).
+static constexpr qint64 kMemoryLayerSize = 64 * 1024 * 1024;
+
+namespace {
+/// Least recently used decoded tiles, with their checksum.
+class MemoryLayer {
+public:
+  MemoryLayer() : bytes_(0), limit_(kMemoryLayerSize) {}
+
+  QImage find(const std::string &key, QByteArray *checksum) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    const auto it = entries_.find(key);
+    if (it == entries_.end()) {
+      return QImage();
+    }
+    lru_.splice(lru_.begin(), lru_, it->second.lru);
+    if (checksum) {
+      *checksum = it->second.checksum;
+    }
+    return it->second.image;
+  }
+
+  bool contains(const std::string &key) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return entries_.count(key) > 0;
+  }
+
+  void insert(const std::string &key, const QImage &image,
+              const QByteArray &checksum) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    eraseLocked(key);
+    Entry &entry = entries_[key];
+    entry.image = image;
+    entry.checksum = checksum;
+    entry.lru = lru_.insert(lru_.begin(), key);
+    bytes_ += image.byteCount();
+    trimLocked(1);
+  }
+
+  void setLimit(qint64 bytes) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    limit_ = bytes;
+    trimLocked(0);
+  }
+
+  qint64 limit() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return limit_;
+  }
+
+  qint64 bytes() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return bytes_;
+  }
+
+  void erase(const std::string &key) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    eraseLocked(key);
+  }
+
+private:
+  struct Entry {
+    QImage image;
+    QByteArray checksum;
+    std::list<std::string>::iterator lru;
+  };
+
+  /// Drop the least recently used tiles until within the limit, keeping at
+  /// least `keep`.
+  void trimLocked(std::size_t keep) {
+    while (bytes_ > limit_ && lru_.size() > keep) {
+      eraseLocked(lru_.back());
+    }
+  }
+
+  void eraseLocked(const std::string &key) {
+    const auto it = entries_.find(key);
+    if (it != entries_.end()) {
+      bytes_ -= it->second.image.byteCount();
+      lru_.erase(it->second.lru);
+      entries_.erase(it);
+    }
+  }
+
+  std::mutex mutex_;
+  std::map<std::string, Entry> entries_;
+  /// Most recently used first.
+  std::list<std::string> lru_;
+  qint64 bytes_;
+  qint64 limit_;
+};
+} // namespace
+
+static MemoryLayer memory_layer;
+
+LayeredTileCache::LayeredTileCache(const std::string &cache_path,
+                                   const std::vector<std::string> &base_paths,
+                                   const std::string &object_uri)
+    : local_(cache_path, object_uri) {
+  for (const std::string &base_path : base_paths) {
+    if (!base_path.empty()) {
+      bases_.push_back(
+          std::make_shared<TileCache>(base_path, object_uri, true));
+    }
+  }
+}
+
+std::string LayeredTileCache::memoryKey(int x, int y, int z) const {
+  //  the local folder identifies the tile server
+  return local_.path().toStdString() + "/" + std::to_string(z) + "/" +
+         std::to_string(x) + "/" + std::to_string(y);
+}
+
+bool LayeredTileCache::contains(int x, int y, int z) const {
+  if (memory_layer.contains(memoryKey(x, y, z)) || local_.contains(x, y, z)) {
+    return true;
+  }
+  for (const std::shared_ptr<TileCache> &base : bases_) {
+    if (base->contains(x, y, z)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+QImage LayeredTileCache::load(int x, int y, int z, QByteArray *checksum,
+                              int scale) const {
+  const std::string key = memoryKey(x, y, z);
+  QImage image = memory_layer.find(key, checksum);
+  if (!image.isNull()) {
+    return scale > 1 ? image.scaled(image.width() / scale,
+                                    image.height() / scale,
+                                    Qt::IgnoreAspectRatio,
+                                    Qt::SmoothTransformation)
+                     : image;
+  }
+  QByteArray sum;
+  if (local_.contains(x, y, z)) {
+    image = local_.load(x, y, z, &sum, scale);
+  }
+  for (std::size_t i = 0; i < bases_.size() && image.isNull(); i++) {
+    if (bases_[i]->contains(x, y, z)) {
+      image = bases_[i]->load(x, y, z, &sum, scale);
+    }
+  }
+  if (!image.isNull()) {
+    if (scale == 1) {
+      memory_layer.insert(key, image, sum);
+    }
+    if (checksum) {
+      *checksum = sum;
+    }
+  }
+  return image;
+}
+
+void LayeredTileCache::preload(const TileArea &area) const {
+  //  in rings around the centre, and no more than the memory layer holds:
+  //  the outer tiles would only evict the central ones
+  const int centre_x = (area.min_x + area.max_x) / 2;
+  const int centre_y = (area.min_y + area.max_y) / 2;
+  const int rings = std::max(std::max(centre_x - area.min_x,
+                                      area.max_x - centre_x),
+                             std::max(centre_y - area.min_y,
+                                      area.max_y - centre_y));
+  qint64 bytes = 0;
+  for (int ring = 0; ring <= rings; ring++) {
+    for (int y = std::max(area.min_y, centre_y - ring);
+         y <= std::min(area.max_y, centre_y + ring); y++) {
+      //  the whole row on the top and bottom of the ring, its ends otherwise
+      const bool edge = (y == centre_y - ring || y == centre_y + ring);
+      const int step = (edge || ring == 0) ? 1 : 2 * ring;
+      for (int x = centre_x - ring; x <= centre_x + ring; x += step) {
+        if (x < area.min_x || x > area.max_x || !contains(x, y, area.z)) {
+          continue;
+        }
+        bytes += load(x, y, area.z).byteCount();
+        if (bytes >= memory_layer.limit()) {
+          return;
+        }
+      }
+    }
+  }
+}
+
+void LayeredTileCache::setMemoryLimit(qint64 bytes) {
+  memory_layer.setLimit(bytes);
+}
+
+qint64 LayeredTileCache::memoryBytes() { return memory_layer.bytes(); }
+
+QImage LayeredTileCache::loadShared(int x, int y, int z,
+                                    QByteArray *checksum) const {
+  QByteArray sum;
+  const QImage image = local_.load(x, y, z, &sum);
+  if (!image.isNull()) {
+    memory_layer.insert(memoryKey(x, y, z), image, sum);
+    if (checksum) {
+      *checksum = sum;
+    }
+  }
+  return image;
+}
+
+std::shared_ptr<const PixelBlock>
+LayeredTileCache::loadPixels(int x, int y, int z,
+                             QByteArray *checksum) const {
+  //  load() is cheaper then
+  if (memory_layer.contains(memoryKey(x, y, z)) || !local_.contains(x, y, z)) {
+    return nullptr;
+  }
+  return local_.loadPixels(x, y, z, checksum);
+}
+
+bool LayeredTileCache::storePixels(int x, int y, int z,
+                                   const QByteArray &checksum,
+                                   const QImage &image) {
+  return local_.contains(x, y, z) &&
+         local_.storePixels(x, y, z, checksum, image);
+}
+
+TileCache::Metadata LayeredTileCache::metadata(int x, int y, int z) const {
+  TileCache::Metadata meta;
+  if (local_.contains(x, y, z)) {
+    return local_.metadata(x, y, z);
+  }
+  //  tile from a read-only layer, possibly revalidated locally
+  if (local_.readMetadata(x, y, z, meta)) {
+    return meta;
+  }
+  for (const std::shared_ptr<TileCache> &base : bases_) {
+    if (base->contains(x, y, z)) {
+      return base->metadata(x, y, z);
+    }
+  }
+  return meta;
+}
+
+bool LayeredTileCache::store(int x, int y, int z, const QByteArray &data,
+                             const TileCache::Metadata &meta) {
+  //  decoded again from the local layer on next load
+  memory_layer.erase(memoryKey(x, y, z));
+  return local_.store(x, y, z, data, meta);
+}
+
+bool LayeredTileCache::storeMetadata(int x, int y, int z,
+                                     const TileCache::Metadata &meta) {
+  return local_.storeMetadata(x, y, z, meta);
+}
+
+bool LayeredTileCache::markMissing(int x, int y, int z) {
+  return local_.markMissing(x, y, z);
+}
+
+bool LayeredTileCache::isMissing(int x, int y, int z, qint64 now) const {
+  if (local_.isMissing(x, y, z, now)) {
+    return true;
+  }
+  for (const std::shared_ptr<TileCache> &base : bases_) {
+    if (base->isMissing(x, y, z, now)) {
+      return true;
+    }
+  }
+  return false;
+}
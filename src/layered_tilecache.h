@@ -0,0 +1,121 @@
+/*
+ * LayeredTileCache.h
+ *
+ *  Copyright (c) 2014 Gaeth Cross. Apache 2 License.
+ *
+ *  This file is part of rviz_satellite.
+ *
+ *	Created on: 16/10/2026
+ */
+
+#ifndef LAYERED_TILECACHE_H
+#define LAYERED_TILECACHE_H
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "tilecache.h"
+
+/**
+ * @class LayeredTileCache
+ * @brief Stack of tile caches, looked up in order.
+ *
+ * The layers are: decoded tiles in memory, shared by the whole process, then
+ * the local on-disk cache, which receives every write, then any number of
+ * read-only on-disk caches, e.g. imagery shipped to a fleet of robots.
+ */
+class LayeredTileCache {
+public:
+  /// @throw std::runtime_error if the local cache folder cannot be created.
+  LayeredTileCache(const std::string &cache_path,
+                   const std::vector<std::string> &base_paths,
+                   const std::string &object_uri);
+
+  /// Folder of the local cache.
+  const QString &path() const { return local_.path(); }
+
+  /// Is tile [x,y,z] in any layer?
+  bool contains(int x, int y, int z) const;
+
+  /// Tile [x,y,z] from the first layer that has it, at 1/`scale` of its
+  /// size. Null image if none. The checksum of the tile is written to
+  /// `checksum`, if given. Only full size tiles are kept in memory.
+  QImage load(int x, int y, int z, QByteArray *checksum = nullptr,
+              int scale = 1) const;
+
+  /// Decode the cached tiles of `area` into memory, so that later loads
+  /// take no disk access. Central tiles first, up to the size of the memory
+  /// layer.
+  void preload(const TileArea &area) const;
+
+  /// Tile [x,y,z] from the local folder, even if it is not indexed yet, e.g.
+  /// because another process just stored it. Null image if none.
+  QImage loadShared(int x, int y, int z,
+                    QByteArray *checksum = nullptr) const;
+
+  /// Pixels of tile [x,y,z] from the local folder. Null if there are none,
+  /// or if the decoded tile is in memory already. The checksum of the tile is
+  /// written to `checksum`, if given.
+  std::shared_ptr<const PixelBlock> loadPixels(int x, int y, int z,
+                                               QByteArray *checksum) const;
+
+  /// Store the decoded `image` of tile [x,y,z] as pixels, if the tile is in
+  /// the local folder.
+  bool storePixels(int x, int y, int z, const QByteArray &checksum,
+                   const QImage &image);
+
+  /// Metadata of tile [x,y,z]. Metadata refreshed locally takes precedence
+  /// over that of a read-only layer.
+  TileCache::Metadata metadata(int x, int y, int z) const;
+
+  /// Store tile [x,y,z] in the local cache.
+  bool store(int x, int y, int z, const QByteArray &data,
+             const TileCache::Metadata &meta);
+
+  /// Store the metadata of tile [x,y,z] in the local cache, even if the tile
+  /// itself is in a read-only layer.
+  bool storeMetadata(int x, int y, int z, const TileCache::Metadata &meta);
+
+  /// Record in the local cache that the server does not have tile [x,y,z].
+  bool markMissing(int x, int y, int z);
+
+  /// Was tile [x,y,z] recently found missing, according to any layer?
+  bool isMissing(int x, int y, int z, qint64 now) const;
+
+  /// Was tile [x,y,z] recently found missing by this or another process
+  /// sharing the local folder, even if the marker is not indexed yet?
+  bool isMissingShared(int x, int y, int z, qint64 now) const {
+    return local_.isMissing(x, y, z, now, true);
+  }
+
+  /// Cap the size of the local cache, 0 for no limit.
+  void setMaxSize(qint64 bytes) { local_.setMaxSize(bytes); }
+
+  /// @see TileCache::tryLock
+  bool tryLock(int x, int y, int z) { return local_.tryLock(x, y, z); }
+
+  /// @see TileCache::isLocked
+  bool isLocked(int x, int y, int z) const {
+    return local_.isLocked(x, y, z);
+  }
+
+  /// @see TileCache::unlock
+  void unlock(int x, int y, int z) { local_.unlock(x, y, z); }
+
+  /// Cap the size of the decoded tiles in memory, for the whole process.
+  /// The least recently used are dropped until within. Any thread.
+  static void setMemoryLimit(qint64 bytes);
+
+  /// Size of the decoded tiles in memory, for the whole process. Any thread.
+  static qint64 memoryBytes();
+
+private:
+  /// Key of tile [x,y,z] in the memory layer.
+  std::string memoryKey(int x, int y, int z) const;
+
+  TileCache local_;
+  std::vector<std::shared_ptr<TileCache>> bases_;
+};
+
+#endif // LAYERED_TILECACHE_H
@@ -0,0 +1,87 @@
+/*
+ * ProgressiveJpeg.cpp
+ *
+ *  Copyright (c) 2014 Gaeth Cross. Apache 2 License.
+ *
+ *  This file is part of rviz_satellite.
+ *
+ *	Created on: 16/10/2026
+ */
+
+#include "progressive_jpeg.h"
+
+// JPEG markers.
+static constexpr unsigned char kMarkerSof2 = 0xC2;
+static constexpr unsigned char kMarkerSos = 0xDA;
+static constexpr unsigned char kMarkerEoi = 0xD9;
+
+int ProgressiveJpeg::isProgressive(const char *data, int size) {
+  const unsigned char *bytes = reinterpret_cast<const unsigned char *>(data);
+  if (size < 2) {
+    return 0;
+  }
+  if (bytes[0] != 0xFF || bytes[1] != 0xD8) {
+    return -1;
+  }
+  int pos = 2;
+  while (pos + 4 <= size) {
+    if (bytes[pos] != 0xFF) {
+      return -1; //  not a marker
+    }
+    const unsigned char marker = bytes[pos + 1];
+    if (marker == 0xFF) {
+      pos++; //  fill byte
+      continue;
+    }
+    //  start of frame, except for DHT, JPG and DAC in the same range
+    if (marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 &&
+        marker != 0xC8 && marker != 0xCC) {
+      return marker == kMarkerSof2 ? 1 : -1;
+    }
+    if (marker == kMarkerSos || marker == kMarkerEoi) {
+      return -1; //  no frame header
+    }
+    pos += 2 + ((bytes[pos + 2] << 8) | bytes[pos + 3]);
+  }
+  return 0;
+}
+
+int ProgressiveJpeg::completedScans(const char *data, int size, int &end) {
+  const unsigned char *bytes = reinterpret_cast<const unsigned char *>(data);
+  end = 0;
+  if (size < 4 || bytes[0] != 0xFF || bytes[1] != 0xD8) {
+    return 0;
+  }
+  int scans = 0;
+  int pos = 2;
+  while (pos + 4 <= size) {
+    if (bytes[pos] != 0xFF) {
+      return 0; //  not a marker, give up
+    }
+    const unsigned char marker = bytes[pos + 1];
+    if (marker == 0xFF) {
+      pos++; //  fill byte
+      continue;
+    }
+    if (marker == kMarkerEoi) {
+      break;
+    }
+    pos += 2 + ((bytes[pos + 2] << 8) | bytes[pos + 3]);
+    if (marker != kMarkerSos) {
+      continue;
+    }
+    //  the scan ends at the next marker, other than a stuffed zero or a
+    //  restart marker
+    while (pos + 1 < size &&
+           !(bytes[pos] == 0xFF && bytes[pos + 1] != 0 &&
+             (bytes[pos + 1] < 0xD0 || bytes[pos + 1] > 0xD7))) {
+      pos++;
+    }
+    if (pos + 1 >= size) {
+      break; //  still arriving
+    }
+    scans++;
+    end = pos;
+  }
+  return scans;
+}
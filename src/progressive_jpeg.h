@@ -0,0 +1,34 @@
+/*
+ * ProgressiveJpeg.h
+ *
+ *  Copyright (c) 2014 Gaeth Cross. Apache 2 License.
+ *
+ *  This file is part of rviz_satellite.
+ *
+ *	Created on: 16/10/2026
+ */
+
+#ifndef PROGRESSIVE_JPEG_H
+#define PROGRESSIVE_JPEG_H
+
+/**
+ * @class ProgressiveJpeg
+ * @brief Finds the scans of a progressive JPEG in its first bytes.
+ *
+ * Only the markers are parsed, so that the bytes of a download in progress
+ * can be looked at on each arrival: decoding them is left to the decoder,
+ * once enough scans are complete for a preview.
+ */
+class ProgressiveJpeg {
+public:
+  /// Is the JPEG starting with the `size` bytes at `data` progressive? 1 if
+  /// it is, -1 if it is not or is no JPEG, 0 if its frame header has not
+  /// arrived yet.
+  static int isProgressive(const char *data, int size);
+
+  /// Number of complete scans in the `size` bytes at `data`, the start of a
+  /// progressive JPEG. `end` is set to the offset just past the last one.
+  static int completedScans(const char *data, int size, int &end);
+};
+
+#endif // PROGRESSIVE_JPEG_H
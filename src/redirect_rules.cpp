@@ -0,0 +1,63 @@
+/*
+ * RedirectRules.cpp
+ *
+ *  Copyright (c) 2014 Gaeth Cross. Apache 2 License.
+ *
+ *  This file is part of rviz_satellite.
+ *
+ *	Created on: 16/10/2026
+ */
+
+#include "redirect_rules.h"
+
+#include <algorithm>
+
+/// Length of the scheme and authority at the start of `uri`.
+static std::size_t originLength(const std::string &uri) {
+  const std::size_t scheme = uri.find("://");
+  if (scheme == std::string::npos) {
+    return 0;
+  }
+  const std::size_t path = uri.find('/', scheme + 3);
+  return path == std::string::npos ? uri.size() : path;
+}
+
+std::string RedirectRules::apply(const std::string &object_uri) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  const auto it = rules_.find(object_uri);
+  return it != rules_.end() ? it->second : object_uri;
+}
+
+bool RedirectRules::learn(const std::string &object_uri,
+                          const std::string &from, const std::string &to) {
+  const std::string current = apply(object_uri);
+  const std::string literal = current.substr(0, current.find('{'));
+
+  //  the tile specific part is in the common suffix, which must leave the
+  //  origins whole, e.g. not rewrite "http" to "https"
+  std::size_t suffix = 0;
+  const std::size_t max_suffix = std::min(from.size() - originLength(from),
+                                          to.size() - originLength(to));
+  while (suffix < max_suffix &&
+         from[from.size() - 1 - suffix] == to[to.size() - 1 - suffix]) {
+    suffix++;
+  }
+  const std::string old_prefix = from.substr(0, from.size() - suffix);
+  const std::string new_prefix = to.substr(0, to.size() - suffix);
+  //  a new prefix extending the old one would match again
+  if (old_prefix.empty() ||
+      new_prefix.compare(0, old_prefix.size(), old_prefix) == 0 ||
+      old_prefix.size() > literal.size() ||
+      literal.compare(0, old_prefix.size(), old_prefix) != 0) {
+    return false;
+  }
+
+  const std::string moved = new_prefix + current.substr(old_prefix.size());
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::string &rule = rules_[object_uri];
+  if (rule == moved) {
+    return false;
+  }
+  rule = moved;
+  return true;
+}
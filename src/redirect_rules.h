@@ -0,0 +1,43 @@
+/*
+ * RedirectRules.h
+ *
+ *  Copyright (c) 2014 Gaeth Cross. Apache 2 License.
+ *
+ *  This file is part of rviz_satellite.
+ *
+ *	Created on: 16/10/2026
+ */
+
+#ifndef REDIRECT_RULES_H
+#define REDIRECT_RULES_H
+
+#include <map>
+#include <mutex>
+#include <string>
+
+/**
+ * @class RedirectRules
+ * @brief Permanent redirects learned from tile servers.
+ *
+ * Maps each configured object URI to the object URI its tiles moved to, as
+ * learned from the redirect of one of them, so that later tiles are
+ * requested from the new location directly. All methods are thread safe.
+ */
+class RedirectRules {
+public:
+  /// `object_uri` rewritten according to the redirects learned so far.
+  std::string apply(const std::string &object_uri) const;
+
+  /// Learn that the tiles of `object_uri` moved permanently, from the
+  /// redirect of one of them from `from` to `to`. False if nothing was
+  /// learned: the redirect does not rewrite a prefix of the object URI, its
+  /// target would be redirected again, or it is known already.
+  bool learn(const std::string &object_uri, const std::string &from,
+             const std::string &to);
+
+private:
+  mutable std::mutex mutex_;
+  std::map<std::string, std::string> rules_;
+};
+
+#endif // REDIRECT_RULES_H
@@ -0,0 +1,199 @@
+/*
+ * seed.cpp
+ *
+ *  Copyright (c) 2014 Gaeth Cross. Apache 2 License.
+ *
+ *  This file is part of rviz_satellite.
+ *
+ *	Created on: 16/10/2026
+ */
+
+/*
+ * rviz_satellite_seed: download the tiles of an area into the cache, for use
+ * with offline mode. Run without arguments for usage.
+ */
+
+#include <QCoreApplication>
+#include <QDir>
+#include <QString>
+#include <QStringList>
+#include <QTimer>
+#include <cstdio>
+#include <exception>
+#include <string>
+#include <vector>
+#include <ros/package.h>
+
+#include "tileseeder.h"
+
+// Default number of requests in flight.
+static constexpr int kDefaultMaxRequests = 4;
+// Default max number of requests per second.
+static constexpr double kDefaultMaxRate = 10;
+
+static void printUsage() {
+  std::fprintf(
+      stderr,
+      "Usage: rviz_satellite_seed --url URI (--bbox S,W,N,E | --polygon "
+      "LAT,LON;LAT,LON;...)\n"
+      "                           --zoom MIN[-MAX] [options]\n"
+      "\n"
+      "Downloads every tile of the area into the cache used by the "
+      "AerialMapDisplay.\n"
+      "Tiles already in the cache are skipped, so an interrupted run can be "
+      "resumed.\n"
+      "\n"
+      "  --url URI           Object URI with {x}, {y}, {z} tokens\n"
+      "  --bbox S,W,N,E      Area as a bounding box, in degrees\n"
+      "  --polygon POINTS    Area as a polygon of LAT,LON points separated "
+      "by ';'\n"
+      "  --zoom MIN[-MAX]    Zoom level or range of zoom levels\n"
+      "  --cache DIR         Cache folder (default: <rviz_satellite>/mapscache)\n"
+      "  --base-cache DIR    Read-only cache, tiles found there are skipped. "
+      "May be repeated\n"
+      "  --proxy HOST:PORT   HTTP proxy\n"
+      "  --max-requests N    Requests in flight (default: %d)\n"
+      "  --max-rate R        Requests per second, 0 for no limit (default: "
+      "%.0f)\n"
+      "  --pin               Never evict the tiles of the area from the cache\n",
+      kDefaultMaxRequests, kDefaultMaxRate);
+}
+
+/// Parse "LAT,LON;LAT,LON;..." into `points`.
+static bool parsePolygon(const QString &text, std::vector<LatLon> &points) {
+  for (const QString &pair : text.split(';')) {
+    const QStringList values = pair.split(',');
+    bool ok_lat = false, ok_lon = false;
+    if (values.size() != 2) {
+      return false;
+    }
+    const double lat = values[0].trimmed().toDouble(&ok_lat);
+    const double lon = values[1].trimmed().toDouble(&ok_lon);
+    if (!ok_lat || !ok_lon) {
+      return false;
+    }
+    points.push_back(LatLon(lat, lon));
+  }
+  return true;
+}
+
+/// Parse "S,W,N,E" into the four corners of the box.
+static bool parseBox(const QString &text, std::vector<LatLon> &points) {
+  const QStringList values = text.split(',');
+  if (values.size() != 4) {
+    return false;
+  }
+  double bounds[4];
+  for (int i = 0; i < 4; i++) {
+    bool ok = false;
+    bounds[i] = values[i].trimmed().toDouble(&ok);
+    if (!ok) {
+      return false;
+    }
+  }
+  points.push_back(LatLon(bounds[0], bounds[1]));
+  points.push_back(LatLon(bounds[0], bounds[3]));
+  points.push_back(LatLon(bounds[2], bounds[3]));
+  points.push_back(LatLon(bounds[2], bounds[1]));
+  return true;
+}
+
+/// Parse "MIN" or "MIN-MAX".
+static bool parseZoom(const QString &text, unsigned int &min_zoom,
+                      unsigned int &max_zoom) {
+  const QStringList values = text.split('-');
+  bool ok_min = false, ok_max = false;
+  if (values.size() == 1) {
+    min_zoom = max_zoom = values[0].toUInt(&ok_min);
+    return ok_min;
+  }
+  if (values.size() != 2) {
+    return false;
+  }
+  min_zoom = values[0].toUInt(&ok_min);
+  max_zoom = values[1].toUInt(&ok_max);
+  return ok_min && ok_max;
+}
+
+int main(int argc, char **argv) {
+  QCoreApplication app(argc, argv);
+
+  std::string url, proxy;
+  std::string cache_path = QDir::cleanPath(
+      QString::fromStdString(ros::package::getPath("rviz_satellite")) +
+      QDir::separator() + QString("mapscache")).toStdString();
+  std::vector<std::string> base_cache_paths;
+  std::vector<LatLon> area;
+  unsigned int min_zoom = 0, max_zoom = 0;
+  bool has_zoom = false;
+  int max_requests = kDefaultMaxRequests;
+  double max_rate = kDefaultMaxRate;
+  bool pin = false;
+
+  const QStringList args = QCoreApplication::arguments();
+  for (int i = 1; i < args.size(); i++) {
+    const QString &arg = args[i];
+    if (arg == "--pin") {
+      pin = true;
+      continue;
+    }
+    if (i + 1 >= args.size()) {
+      printUsage();
+      return 1;
+    }
+    const QString value = args[++i];
+    bool ok = true;
+    if (arg == "--url") {
+      url = value.toStdString();
+    } else if (arg == "--bbox") {
+      ok = area.empty() && parseBox(value, area);
+    } else if (arg == "--polygon") {
+      ok = area.empty() && parsePolygon(value, area);
+    } else if (arg == "--zoom") {
+      ok = has_zoom = parseZoom(value, min_zoom, max_zoom);
+    } else if (arg == "--cache") {
+      cache_path = value.toStdString();
+    } else if (arg == "--base-cache") {
+      base_cache_paths.push_back(value.toStdString());
+    } else if (arg == "--proxy") {
+      proxy = value.toStdString();
+    } else if (arg == "--max-requests") {
+      max_requests = value.toInt(&ok);
+    } else if (arg == "--max-rate") {
+      max_rate = value.toDouble(&ok);
+    } else {
+      ok = false;
+    }
+    if (!ok) {
+      std::fprintf(stderr, "Invalid argument: %s %s\n", qPrintable(arg),
+                   qPrintable(value));
+      printUsage();
+      return 1;
+    }
+  }
+  if (url.empty() || area.empty() || !has_zoom) {
+    printUsage();
+    return 1;
+  }
+
+  try {
+    TileSeeder seeder(url, proxy, cache_path, base_cache_paths, area,
+                      min_zoom, max_zoom);
+    seeder.setMaxRequests(max_requests);
+    seeder.setMaxRate(max_rate);
+    if (pin && !seeder.pin()) {
+      std::fprintf(stderr, "Failed to pin the area\n");
+      return 1;
+    }
+    QObject::connect(&seeder, SIGNAL(finished()), &app, SLOT(quit()));
+    //  start from the event loop, so quit() is not called before exec()
+    QTimer::singleShot(0, &seeder, SLOT(start()));
+    if (app.exec() != 0) {
+      return 1;
+    }
+    return seeder.failed() > 0 ? 2 : 0;
+  } catch (std::exception &e) {
+    std::fprintf(stderr, "%s\n", e.what());
+    return 1;
+  }
+}
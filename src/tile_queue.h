@@ -0,0 +1,135 @@
+/*
+ * TileQueue.h
+ *
+ *  Copyright (c) 2014 Gaeth Cross. Apache 2 License.
+ *
+ *  This file is part of rviz_satellite.
+ *
+ *	Created on: 16/10/2026
+ */
+
+#ifndef TILE_QUEUE_H
+#define TILE_QUEUE_H
+
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <memory>
+
+/**
+ * @class TileQueue
+ * @brief Bounded lock-free queue with many producers and one consumer.
+ *
+ * Hands decoded tiles from the decoding threads to the render thread without
+ * locks. Producers reserve a slot before doing the work that fills it, so
+ * that work stops, rather than piles up, while the consumer falls behind:
+ *
+ *   if (queue.tryReserve()) { decode; queue.push(tile); }
+ *
+ * The ring buffer follows D. Vyukov's bounded MPMC queue: each slot carries
+ * a sequence number telling whose turn it is to use it.
+ */
+template <typename T> class TileQueue {
+public:
+  /// `capacity` is rounded up to a power of two.
+  explicit TileQueue(std::size_t capacity)
+      : reserved_(0), enqueue_pos_(0), dequeue_pos_(0) {
+    std::size_t size = 1;
+    while (size < capacity) {
+      size <<= 1;
+    }
+    mask_ = size - 1;
+    cells_.reset(new Cell[size]);
+    for (std::size_t i = 0; i < size; i++) {
+      cells_[i].sequence.store(i, std::memory_order_relaxed);
+    }
+  }
+
+  TileQueue(const TileQueue &) = delete;
+  TileQueue &operator=(const TileQueue &) = delete;
+
+  /// Number of slots.
+  std::size_t capacity() const { return mask_ + 1; }
+
+  /// Claim a slot for a later push(). False if all slots are taken by
+  /// queued or reserved items. Any thread.
+  bool tryReserve() {
+    std::size_t reserved = reserved_.load(std::memory_order_relaxed);
+    do {
+      if (reserved > mask_) {
+        return false;
+      }
+      //  acquire pairs with release(), so the slot freed by pop() is seen
+      //  free by push()
+    } while (!reserved_.compare_exchange_weak(reserved, reserved + 1,
+                                              std::memory_order_acq_rel,
+                                              std::memory_order_relaxed));
+    return true;
+  }
+
+  /// Give back a slot claimed with tryReserve() without pushing. Any thread.
+  void release() { reserved_.fetch_sub(1, std::memory_order_acq_rel); }
+
+  /// Append `item` in a slot claimed with tryReserve(). Any thread.
+  void push(T item) {
+    Cell *cell;
+    std::size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+    for (;;) {
+      cell = &cells_[pos & mask_];
+      const std::size_t sequence = cell->sequence.load(std::memory_order_acquire);
+      const std::ptrdiff_t diff = static_cast<std::ptrdiff_t>(sequence) -
+                                  static_cast<std::ptrdiff_t>(pos);
+      if (diff == 0) {
+        //  the slot is free, try to take it
+        if (enqueue_pos_.compare_exchange_weak(pos, pos + 1,
+                                               std::memory_order_relaxed)) {
+          break;
+        }
+      } else {
+        //  never full thanks to the reservation, so another producer got it
+        assert(diff > 0);
+        pos = enqueue_pos_.load(std::memory_order_relaxed);
+      }
+    }
+    cell->item = std::move(item);
+    cell->sequence.store(pos + 1, std::memory_order_release);
+  }
+
+  /// Nothing queued or reserved, i.e. no item is on its way. Consumer thread
+  /// only.
+  bool idle() const { return reserved_.load(std::memory_order_acquire) == 0; }
+
+  /// Take the oldest item into `item`. False if there is none. Consumer
+  /// thread only.
+  bool pop(T &item) {
+    const std::size_t pos = dequeue_pos_;
+    Cell &cell = cells_[pos & mask_];
+    const std::size_t sequence = cell.sequence.load(std::memory_order_acquire);
+    if (sequence != pos + 1) {
+      //  empty, or the producer of this slot is not done yet
+      return false;
+    }
+    item = std::move(cell.item);
+    cell.item = T();
+    cell.sequence.store(pos + mask_ + 1, std::memory_order_release);
+    dequeue_pos_ = pos + 1;
+    release();
+    return true;
+  }
+
+private:
+  struct Cell {
+    std::atomic<std::size_t> sequence;
+    T item;
+  };
+
+  std::unique_ptr<Cell[]> cells_;
+  std::size_t mask_;
+  /// Slots queued or reserved
+  std::atomic<std::size_t> reserved_;
+  std::atomic<std::size_t> enqueue_pos_;
+  /// Only touched by the consumer
+  std::size_t dequeue_pos_;
+};
+
+#endif // TILE_QUEUE_H
@@ -0,0 +1,178 @@
+/*
+ * TileService.cpp
+ *
+ *  Copyright (c) 2014 Gaeth Cross. Apache 2 License.
+ *
+ *  This file is part of rviz_satellite.
+ *
+ *	Created on: 16/10/2026
+ */
+
+#include "tile_service.h"
+#include "latency_tracker.h"
+#include "concurrency_controller.h"
+#include "tilecache.h"
+
+#include <QImage>
+#include <QThread>
+#include <algorithm>
+
+#include <OGRE/OgreTextureManager.h>
+
+// Size of the textures and decoded tiles held by the process (bytes).
+static constexpr qint64 kMemoryBudget = 192 * 1024 * 1024;
+
+static Ogre::TexturePtr textureFromImage(const QImage &image,
+                                         const std::string &name) {
+  //  decoded into 24bit rgb, bottom-up, on the thread pool already
+  const QImage converted = TileCache::toUploadLayout(image);
+
+  //  create texture
+  Ogre::TexturePtr texture;
+  Ogre::DataStreamPtr data_stream;
+  data_stream.bind(new Ogre::MemoryDataStream((void *)converted.constBits(),
+                                              converted.byteCount()));
+
+  const Ogre::String res_group =
+      Ogre::ResourceGroupManager::DEFAULT_RESOURCE_GROUP_NAME;
+  Ogre::TextureManager &texture_manager = Ogre::TextureManager::getSingleton();
+  //  swap byte order when going from QImage to Ogre
+  texture = texture_manager.loadRawData(name, res_group, data_stream,
+                                        converted.width(), converted.height(),
+                                        Ogre::PF_B8G8R8, Ogre::TEX_TYPE_2D, 0);
+  return texture;
+}
+
+static Ogre::TexturePtr textureFromPixels(const PixelBlock &pixels,
+                                          const std::string &name) {
+  //  already converted and flipped, upload straight from the mapping
+  Ogre::DataStreamPtr data_stream;
+  data_stream.bind(new Ogre::MemoryDataStream(
+      const_cast<uchar *>(pixels.data()), pixels.size(), false, true));
+
+  const Ogre::String res_group =
+      Ogre::ResourceGroupManager::DEFAULT_RESOURCE_GROUP_NAME;
+  Ogre::TextureManager &texture_manager = Ogre::TextureManager::getSingleton();
+  return texture_manager.loadRawData(name, res_group, data_stream,
+                                     pixels.width(), pixels.height(),
+                                     Ogre::PF_B8G8R8, Ogre::TEX_TYPE_2D, 0);
+}
+
+/// Size of `texture` on the GPU, roughly.
+static qint64 textureBytes(const Ogre::TexturePtr &texture) {
+  return static_cast<qint64>(texture->getWidth()) * texture->getHeight() * 3;
+}
+
+std::shared_ptr<TileService> TileService::instance() {
+  //  GUI thread only, no need to lock
+  static std::weak_ptr<TileService> current;
+  std::shared_ptr<TileService> service = current.lock();
+  if (!service) {
+    service.reset(new TileService());
+    current = service;
+  }
+  return service;
+}
+
+TileService::TileService()
+    : loader_thread_(new QThread()), used_bytes_(0), unused_bytes_(0),
+      texture_ids_(0) {
+  //  network replies and cache writes are handled off the GUI thread
+  loader_thread_->start();
+  trimTextures();
+}
+
+TileService::~TileService() {
+  for (const auto &pooled : textures_) {
+    Ogre::TextureManager::getSingleton().remove(
+        pooled.second.texture->getName());
+  }
+  //  the loaders left are deleted when their thread finishes
+  loader_thread_->quit();
+  loader_thread_->wait();
+  delete loader_thread_;
+}
+
+std::shared_ptr<LatencyTracker>
+TileService::latencyTracker(const std::string &object_uri) {
+  std::shared_ptr<LatencyTracker> &tracker = latency_trackers_[object_uri];
+  if (!tracker) {
+    tracker.reset(new LatencyTracker());
+  }
+  return tracker;
+}
+
+std::shared_ptr<ConcurrencyController>
+TileService::concurrencyController(const std::string &object_uri) {
+  std::shared_ptr<ConcurrencyController> &controller = controllers_[object_uri];
+  if (!controller) {
+    controller.reset(new ConcurrencyController());
+  }
+  return controller;
+}
+
+Ogre::TexturePtr
+TileService::acquireTexture(const QByteArray &key,
+                            const TileLoader::DecodedTile &tile) {
+  const auto it = textures_.find(key);
+  if (it != textures_.end()) {
+    PooledTexture &pooled = it->second;
+    if (pooled.users++ == 0) {
+      unused_.erase(pooled.unused);
+      unused_bytes_ -= textureBytes(pooled.texture);
+      used_bytes_ += textureBytes(pooled.texture);
+      trimTextures();
+    }
+    return pooled.texture;
+  }
+
+  const std::string name = "tile_texture_" + std::to_string(texture_ids_++);
+  PooledTexture &pooled = textures_[key];
+  if (tile.pixels) {
+    pooled.texture = textureFromPixels(*tile.pixels, name);
+  } else {
+    pooled.texture = textureFromImage(tile.image, name);
+  }
+  pooled.users = 1;
+  pooled.unused = unused_.end();
+  used_bytes_ += textureBytes(pooled.texture);
+  trimTextures();
+  return pooled.texture;
+}
+
+void TileService::releaseTexture(const QByteArray &key, bool reusable) {
+  const auto it = textures_.find(key);
+  if (it == textures_.end() || it->second.users == 0) {
+    return;
+  }
+  PooledTexture &pooled = it->second;
+  if (--pooled.users > 0) {
+    return;
+  }
+  used_bytes_ -= textureBytes(pooled.texture);
+  if (reusable) {
+    pooled.unused = unused_.insert(unused_.begin(), key);
+    unused_bytes_ += textureBytes(pooled.texture);
+  } else {
+    //  would only push reusable textures out of the pool
+    Ogre::TextureManager::getSingleton().remove(pooled.texture->getName());
+    textures_.erase(it);
+  }
+  trimTextures();
+}
+
+void TileService::trimTextures() {
+  //  textures shown come first, then half of the rest for decoded tiles,
+  //  which make new windows load fast, then unused textures, for reloads
+  const qint64 available = std::max<qint64>(0, kMemoryBudget - used_bytes_);
+  LayeredTileCache::setMemoryLimit(available / 2);
+  const qint64 unused_budget = available - LayeredTileCache::memoryBytes();
+  while (unused_bytes_ > unused_budget && !unused_.empty()) {
+    const auto it = textures_.find(unused_.back());
+    unused_.pop_back();
+    unused_bytes_ -= textureBytes(it->second.texture);
+    Ogre::TextureManager::getSingleton().remove(
+        it->second.texture->getName());
+    textures_.erase(it);
+  }
+}
@@ -0,0 +1,102 @@
+/*
+ * TileService.h
+ *
+ *  Copyright (c) 2014 Gaeth Cross. Apache 2 License.
+ *
+ *  This file is part of rviz_satellite.
+ *
+ *	Created on: 16/10/2026
+ */
+
+#ifndef TILE_SERVICE_H
+#define TILE_SERVICE_H
+
+// NOTE: workaround for issue: https://bugreports.qt.io/browse/QTBUG-22829
+#ifndef Q_MOC_RUN
+#include <OGRE/OgreTexture.h>
+#endif  //  Q_MOC_RUN
+
+#include <QByteArray>
+#include <list>
+#include <map>
+#include <memory>
+#include <string>
+
+#include <tileloader.h>
+
+class QThread;
+class LatencyTracker;
+class ConcurrencyController;
+
+/**
+ * @class TileService
+ * @brief Resources shared by all AerialMapDisplay instances of the process.
+ *
+ * Owns the thread the tile loaders run on, the latency history and request
+ * limit of each tile server, and a pool of tile textures, so that identical
+ * tiles shown by several displays, or shown again after a reload, are
+ * uploaded once. Decoded tiles in memory and downloads are shared by
+ * LayeredTileCache and TileLoader already; the service caps the decoded
+ * tiles and the textures together, to one memory budget for the process.
+ *
+ * The service lives as long as a display holds it. It must only be used from
+ * the GUI thread.
+ */
+class TileService {
+public:
+  /// The service of the process, created if there is none.
+  static std::shared_ptr<TileService> instance();
+
+  ~TileService();
+
+  /// Thread the tile loaders run on.
+  QThread *loaderThread() const { return loader_thread_; }
+
+  /// Latencies of recent requests to `object_uri`.
+  std::shared_ptr<LatencyTracker> latencyTracker(const std::string &object_uri);
+
+  /// Limit on requests in flight to `object_uri`.
+  std::shared_ptr<ConcurrencyController>
+  concurrencyController(const std::string &object_uri);
+
+  /// Texture of `tile`, uploaded unless the pool has one for `key`, e.g. the
+  /// checksum of the tile. Give it back with releaseTexture().
+  Ogre::TexturePtr acquireTexture(const QByteArray &key,
+                                  const TileLoader::DecodedTile &tile);
+
+  /// Give back a texture from acquireTexture(). Textures no display uses are
+  /// kept for reuse within the memory budget, least recently used first out,
+  /// unless not `reusable`, e.g. previews: those are destroyed.
+  void releaseTexture(const QByteArray &key, bool reusable = true);
+
+private:
+  TileService();
+  TileService(const TileService &) = delete;
+  TileService &operator=(const TileService &) = delete;
+
+  /// Share the memory budget left by the textures in use between the
+  /// decoded tiles and the unused textures, and delete unused textures until
+  /// within their share.
+  void trimTextures();
+
+  /// Texture in the pool
+  struct PooledTexture {
+    Ogre::TexturePtr texture;
+    int users;
+    /// Position in unused_, if users is 0
+    std::list<QByteArray>::iterator unused;
+  };
+
+  QThread *loader_thread_;
+  std::map<std::string, std::shared_ptr<LatencyTracker>> latency_trackers_;
+  std::map<std::string, std::shared_ptr<ConcurrencyController>> controllers_;
+  std::map<QByteArray, PooledTexture> textures_;
+  /// Keys of the textures no display uses, most recently used first
+  std::list<QByteArray> unused_;
+  /// Size of the textures in use
+  qint64 used_bytes_;
+  qint64 unused_bytes_;
+  unsigned int texture_ids_;
+};
+
+#endif // TILE_SERVICE_H
@@ -0,0 +1,1080 @@
+/*
+ * TileCache.cpp
+ *
+ *  Copyright (c) 2014 Gaeth Cross. Apache 2 License.
+ *
+ *  This file is part of rviz_satellite.
+ *
+ *	Created on: 16/10/2026
+ */
+
+#include "tilecache.h"
+
+#include <QCoreApplication>
+#include <QBuffer>
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QImageReader>
+#include <QNetworkReply>
+#include <QNetworkRequest>
+#include <QStringList>
+#include <QtConcurrentRun>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <unordered_set>
+#include <functional> // for std::hash
+#include <list>
+#include <unordered_map>
+#include <vector>
+#include <ros/ros.h>
+
+#ifdef RVIZ_SATELLITE_TURBOJPEG
+#include <turbojpeg.h>
+#endif
+
+// Freshness lifetime of tiles the server gave no lifetime for (s).
+static constexpr qint64 kDefaultMaxAge = 7 * 24 * 3600;
+// Time before a tile found missing on the server is requested again (s).
+static constexpr qint64 kMissingTtl = 24 * 3600;
+// Fraction of the size limit the cache is trimmed to when it is exceeded, so
+// that eviction does not run on every store.
+static constexpr double kEvictionTarget = 0.9;
+// Name of the file listing the pinned areas, in the cache folder.
+static constexpr const char *kPinnedFile = "pinned";
+// Text key marking images in the layout uploaded to the GPU.
+static constexpr const char *kUploadLayoutKey = "rviz_satellite_upload";
+// Age after which a download lock or temporary file is abandoned (s).
+static constexpr qint64 kLockTtl = 60;
+// Name of the folder holding the tile contents by checksum, in the cache
+// folder.
+static constexpr const char *kBlobFolder = "blobs";
+// Suffix of pixel files, after that of the tile or blob.
+static constexpr const char *kPixelSuffix = ".rgb";
+// Version of the pixel file format, bumped on incompatible changes.
+static constexpr quint32 kPixelVersion = 1;
+
+/// Name for a temporary file next to `path`, unique to this write: threads
+/// of the same process may write the same blob at once.
+static QString temporaryPathFor(const QString &path) {
+  static std::atomic<unsigned int> writes(0);
+  return path + ".tmp" + QString::number(QCoreApplication::applicationPid()) +
+         "_" + QString::number(writes++);
+}
+
+bool TileCache::writeAtomically(const QString &path, const QByteArray &data) {
+  const QString temp_path = temporaryPathFor(path);
+  QFile file(temp_path);
+  if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate) ||
+      file.write(data) != data.size() || !file.flush()) {
+    file.remove();
+    return false;
+  }
+  file.close();
+  //  unlike QFile::rename, rename(2) replaces the target in one step
+  if (std::rename(QFile::encodeName(temp_path).constData(),
+                  QFile::encodeName(path).constData()) != 0) {
+    QFile::remove(temp_path);
+    return false;
+  }
+  return true;
+}
+
+namespace {
+/// Header of a pixel file, followed by the rows of pixels.
+struct PixelHeader {
+  char magic[4];
+  quint32 version;
+  quint32 width;
+  quint32 height;
+  /// Hex SHA-1 of the encoded tile.
+  char checksum[40];
+  char reserved[8];
+};
+static_assert(sizeof(PixelHeader) == 64, "pixel data must stay aligned");
+
+struct TileCoordHash {
+  std::size_t operator()(const TileCoord &tile) const {
+    return (static_cast<std::size_t>(tile.z) << 58) ^
+           (static_cast<std::size_t>(tile.x) << 29) ^
+           static_cast<std::size_t>(tile.y);
+  }
+};
+typedef std::unordered_set<TileCoord, TileCoordHash> TileSet;
+} // namespace
+
+/// Tiles and negative entries present in a cache folder, with the order in
+/// which the tiles were last used.
+struct TileIndex {
+  TileIndex()
+      : ready(false), evicting(false), pinned_modified(0), bytes(0),
+        max_bytes(0) {}
+
+  struct Entry {
+    qint64 bytes;
+    bool pinned;
+    /// Position in `lru`, unless pinned.
+    std::list<TileCoord>::iterator lru;
+  };
+
+  bool isPinned(const TileCoord &tile) const {
+    return std::any_of(
+        pinned.begin(), pinned.end(),
+        [&](const TileArea &area) { return area.contains(tile); });
+  }
+
+  /// Add or replace `tile`, as the most recently used unless `oldest`.
+  void insert(const TileCoord &tile, qint64 size, bool oldest = false) {
+    erase(tile);
+    Entry &entry = tiles[tile];
+    entry.bytes = size;
+    entry.pinned = isPinned(tile);
+    if (!entry.pinned) {
+      entry.lru = oldest ? lru.insert(lru.end(), tile)
+                         : lru.insert(lru.begin(), tile);
+    }
+    bytes += size;
+  }
+
+  void erase(const TileCoord &tile) {
+    const auto it = tiles.find(tile);
+    if (it == tiles.end()) {
+      return;
+    }
+    if (!it->second.pinned) {
+      lru.erase(it->second.lru);
+    }
+    bytes -= it->second.bytes;
+    tiles.erase(it);
+  }
+
+  /// Replace the pinned areas, tiles no longer pinned become the most
+  /// recently used.
+  void repin(const std::vector<TileArea> &areas) {
+    pinned = areas;
+    for (auto &tile : tiles) {
+      const bool now_pinned = isPinned(tile.first);
+      if (now_pinned && !tile.second.pinned) {
+        lru.erase(tile.second.lru);
+      } else if (!now_pinned && tile.second.pinned) {
+        tile.second.lru = lru.insert(lru.begin(), tile.first);
+      }
+      tile.second.pinned = now_pinned;
+    }
+  }
+
+  /// Mark `tile` as the most recently used.
+  void touch(const TileCoord &tile) {
+    const auto it = tiles.find(tile);
+    if (it != tiles.end() && !it->second.pinned) {
+      lru.splice(lru.begin(), lru, it->second.lru);
+    }
+  }
+
+  std::mutex mutex;
+  /// False until the folder was listed, the sets are incomplete until then.
+  bool ready;
+  /// Is an eviction running?
+  bool evicting;
+  std::unordered_map<TileCoord, Entry, TileCoordHash> tiles;
+  /// Unpinned tiles, most recently used first.
+  std::list<TileCoord> lru;
+  TileSet missing;
+  std::vector<TileArea> pinned;
+  /// Modification time of the pinned file `pinned` was read from (ms).
+  qint64 pinned_modified;
+  /// Size of the tiles in the index.
+  qint64 bytes;
+  /// Size limit, 0 for none.
+  qint64 max_bytes;
+};
+
+// Index of each cache folder opened by this process.
+static std::map<std::string, std::shared_ptr<TileIndex>> indices;
+static std::mutex indices_mutex;
+
+std::shared_ptr<const PixelBlock>
+PixelBlock::map(const QString &path, const QByteArray &checksum) {
+  PixelHeader header;
+  if (checksum.size() != sizeof(header.checksum)) {
+    return nullptr;
+  }
+  const int fd = ::open(QFile::encodeName(path).constData(), O_RDONLY);
+  if (fd < 0) {
+    return nullptr;
+  }
+  struct stat info;
+  void *mapping = MAP_FAILED;
+  if (::fstat(fd, &info) == 0 &&
+      info.st_size >= static_cast<off_t>(sizeof(header))) {
+    mapping = ::mmap(nullptr, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  }
+  //  the mapping outlives the descriptor
+  ::close(fd);
+  if (mapping == MAP_FAILED) {
+    return nullptr;
+  }
+
+  std::shared_ptr<PixelBlock> block(new PixelBlock());
+  block->mapping_ = mapping;
+  block->mapping_size_ = info.st_size;
+  std::memcpy(&header, mapping, sizeof(header));
+  if (std::memcmp(header.magic, "RSPX", sizeof(header.magic)) != 0 ||
+      header.version != kPixelVersion ||
+      std::memcmp(header.checksum, checksum.constData(),
+                  sizeof(header.checksum)) != 0 ||
+      static_cast<qint64>(info.st_size) !=
+          static_cast<qint64>(sizeof(header)) +
+              static_cast<qint64>(header.width) * header.height * 3) {
+    return nullptr;
+  }
+  block->data_ = static_cast<const uchar *>(mapping) + sizeof(header);
+  block->width_ = header.width;
+  block->height_ = header.height;
+  return block;
+}
+
+QByteArray PixelBlock::encode(const QImage &image,
+                              const QByteArray &checksum) {
+  const QImage converted = TileCache::toUploadLayout(image);
+  PixelHeader header;
+  std::memset(&header, 0, sizeof(header));
+  std::memcpy(header.magic, "RSPX", sizeof(header.magic));
+  header.version = kPixelVersion;
+  header.width = converted.width();
+  header.height = converted.height();
+  std::memcpy(header.checksum, checksum.constData(),
+              std::min<std::size_t>(checksum.size(), sizeof(header.checksum)));
+
+  //  QImage pads rows to 4 bytes, Ogre expects them packed
+  const int row = converted.width() * 3;
+  QByteArray contents;
+  contents.resize(sizeof(header) + row * converted.height());
+  std::memcpy(contents.data(), &header, sizeof(header));
+  for (int y = 0; y < converted.height(); y++) {
+    std::memcpy(contents.data() + sizeof(header) + y * row,
+                converted.constScanLine(y), row);
+  }
+  return contents;
+}
+
+PixelBlock::~PixelBlock() {
+  if (mapping_) {
+    ::munmap(mapping_, mapping_size_);
+  }
+}
+
+QByteArray TileCache::checksum(const QByteArray &data) {
+  return QCryptographicHash::hash(data, QCryptographicHash::Sha1).toHex();
+}
+
+#ifdef RVIZ_SATELLITE_TURBOJPEG
+/// Decode the JPEG `data` at 1/`scale` of its size with libjpeg-turbo,
+/// straight into 24 bit RGB, with the TJFLAG_* `flags`. Null image if it is
+/// not a JPEG, or if libjpeg-turbo reports anything unusual, e.g. the
+/// truncated data of a preview.
+static QImage decodeTurboJpeg(const QByteArray &data, int scale, int flags) {
+  if (scale < 1 || scale > 8 || (scale & (scale - 1))) {
+    return QImage(); //  not a reduction libjpeg offers
+  }
+  unsigned char *bytes =
+      reinterpret_cast<unsigned char *>(const_cast<char *>(data.constData()));
+  tjhandle handle = tjInitDecompress();
+  if (!handle) {
+    return QImage();
+  }
+  QImage image;
+  int width, height, subsampling;
+  if (tjDecompressHeader2(handle, bytes, data.size(), &width, &height,
+                          &subsampling) == 0) {
+    const tjscalingfactor factor = {1, scale};
+    image = QImage(TJSCALED(width, factor), TJSCALED(height, factor),
+                   QImage::Format_RGB888);
+    //  SIMD IDCT and color conversion, into the rows of the image
+    if (image.isNull() ||
+        tjDecompress2(handle, bytes, data.size(), image.bits(), image.width(),
+                      image.bytesPerLine(), image.height(), TJPF_RGB,
+                      flags) != 0) {
+      image = QImage();
+    }
+  }
+  tjDestroy(handle);
+  return image;
+}
+#endif
+
+/// Decode `data` at 1/`scale` of its size with the image plugins of Qt.
+static QImage decodeWithQt(const QByteArray &data, int scale) {
+  QBuffer buffer;
+  buffer.setData(data);
+  //  detect the format from the content, the suffix is always .jpg
+  QImageReader reader(&buffer);
+  if (scale > 1) {
+    const QSize size = reader.size();
+    if (size.isValid()) {
+      //  the JPEG plugin hands power of two reductions to libjpeg
+      reader.setScaledSize(QSize(std::max(1, size.width() / scale),
+                                 std::max(1, size.height() / scale)));
+    }
+  }
+  return reader.read();
+}
+
+QImage TileCache::decode(const QByteArray &data, int scale) {
+#ifdef RVIZ_SATELLITE_TURBOJPEG
+  const QImage image = decodeTurboJpeg(data, scale, 0);
+  if (!image.isNull()) {
+    return image;
+  }
+#endif
+  return decodeWithQt(data, scale);
+}
+
+QImage TileCache::decodeForUpload(const QByteArray &data, int scale) {
+#ifdef RVIZ_SATELLITE_TURBOJPEG
+  //  rows written bottom-up by libjpeg-turbo, nothing left to convert
+  QImage image = decodeTurboJpeg(data, scale, TJFLAG_BOTTOMUP);
+  if (!image.isNull()) {
+    image.setText(kUploadLayoutKey, "1");
+    return image;
+  }
+#endif
+  return toUploadLayout(decodeWithQt(data, scale));
+}
+
+bool TileCache::isUploadLayout(const QImage &image) {
+  return !image.text(kUploadLayoutKey).isEmpty();
+}
+
+QImage TileCache::toUploadLayout(const QImage &image) {
+  if (image.isNull() || isUploadLayout(image)) {
+    return image;
+  }
+  //  24 bit RGB, and bottom-up like Ogre's texture coordinates
+  QImage converted = image.convertToFormat(QImage::Format_RGB888).mirrored();
+  converted.setText(kUploadLayoutKey, "1");
+  return converted;
+}
+
+bool TileCache::Metadata::isStale(qint64 now) const {
+  const qint64 lifetime = (max_age >= 0) ? max_age : kDefaultMaxAge;
+  return now - fetched > lifetime * 1000;
+}
+
+TileCache::Metadata
+TileCache::metadataFromReply(const QNetworkReply *reply,
+                             const Metadata &previous) {
+  Metadata meta = previous;
+  meta.fetched = QDateTime::currentMSecsSinceEpoch();
+  if (reply->hasRawHeader("ETag")) {
+    meta.etag = reply->rawHeader("ETag");
+  }
+  if (reply->hasRawHeader("Last-Modified")) {
+    meta.last_modified = reply->rawHeader("Last-Modified");
+  }
+
+  meta.max_age = -1;
+  bool must_revalidate = false;
+  for (const QByteArray &part :
+       reply->rawHeader("Cache-Control").toLower().split(',')) {
+    const QByteArray directive = part.trimmed();
+    if (directive == "no-cache" || directive == "no-store") {
+      must_revalidate = true;
+    } else if (directive.startsWith("max-age=")) {
+      bool ok = false;
+      const qint64 max_age = directive.mid(8).toLongLong(&ok);
+      if (ok) {
+        meta.max_age = max_age;
+      }
+    }
+  }
+  if (must_revalidate) {
+    meta.max_age = 0;
+  } else if (meta.max_age < 0) {
+    //  heuristic freshness: 10% of the time since last modification
+    const QDateTime last_modified =
+        reply->header(QNetworkRequest::LastModifiedHeader).toDateTime();
+    if (last_modified.isValid()) {
+      meta.max_age = std::max<qint64>(
+          0, (meta.fetched - last_modified.toMSecsSinceEpoch()) / 10000);
+    }
+  }
+  return meta;
+}
+
+TileCache::TileCache(const std::string &base_path,
+                     const std::string &object_uri, bool read_only)
+    : read_only_(read_only) {
+  std::hash<std::string> hash_fn;
+  path_ = QDir::cleanPath(QString::fromStdString(base_path) + QDir::separator() +
+                          QString::number(hash_fn(object_uri)));
+
+  QDir dir(path_);
+  if (!read_only_ && !dir.exists() && !dir.mkpath(".")) {
+    throw std::runtime_error("Failed to create cache folder: " +
+                             path_.toStdString());
+  }
+
+  std::lock_guard<std::mutex> lock(indices_mutex);
+  std::shared_ptr<TileIndex> &index = indices[path_.toStdString()];
+  if (!index) {
+    //  first time this folder is opened, tiles of the flat layout are moved
+    //  while indexing
+    index = std::make_shared<TileIndex>();
+    index->pinned = loadPinned(path_, index->pinned_modified);
+    QtConcurrent::run(&TileCache::buildIndex, path_, index, !read_only_);
+    if (!read_only_) {
+      //  blobs left behind by a process that died between unlinking a tile
+      //  and releasing its blob
+      QtConcurrent::run(&TileCache::collectBlobs, path_);
+    }
+  }
+  index_ = index;
+}
+
+void TileCache::setMaxSize(qint64 bytes) {
+  if (read_only_) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(index_->mutex);
+    index_->max_bytes = std::max<qint64>(0, bytes);
+  }
+  evictIfFull(path_, index_);
+}
+
+qint64 TileCache::size() const {
+  std::lock_guard<std::mutex> lock(index_->mutex);
+  return index_->bytes;
+}
+
+bool TileCache::pin(const TileArea &area) {
+  if (read_only_) {
+    return false;
+  }
+  QFile file(QDir(path_).filePath(kPinnedFile));
+  const QByteArray line = QByteArray::number(area.z) + " " +
+                          QByteArray::number(area.min_x) + " " +
+                          QByteArray::number(area.min_y) + " " +
+                          QByteArray::number(area.max_x) + " " +
+                          QByteArray::number(area.max_y) + "\n";
+  if (!file.open(QIODevice::WriteOnly | QIODevice::Append) ||
+      file.write(line) != line.size()) {
+    return false;
+  }
+
+  std::lock_guard<std::mutex> lock(index_->mutex);
+  index_->pinned.push_back(area);
+  for (auto &tile : index_->tiles) {
+    if (!tile.second.pinned && area.contains(tile.first)) {
+      index_->lru.erase(tile.second.lru);
+      tile.second.pinned = true;
+    }
+  }
+  return true;
+}
+
+/// Modification time of the pinned file in the cache folder `path` (ms), 0
+/// if there is none.
+static qint64 pinnedModified(const QString &path) {
+  const QFileInfo info(QDir(path).filePath(kPinnedFile));
+  return info.exists() ? info.lastModified().toMSecsSinceEpoch() : 0;
+}
+
+std::vector<TileArea> TileCache::loadPinned(const QString &path,
+                                            qint64 &modified) {
+  std::vector<TileArea> areas;
+  QFile file(QDir(path).filePath(kPinnedFile));
+  modified = pinnedModified(path);
+  if (!file.open(QIODevice::ReadOnly)) {
+    return areas;
+  }
+  //  one "z min_x min_y max_x max_y" area per line
+  while (!file.atEnd()) {
+    const QList<QByteArray> values = file.readLine().trimmed().split(' ');
+    if (values.size() == 5) {
+      areas.push_back(TileArea(values[0].toInt(), values[1].toInt(),
+                               values[2].toInt(), values[3].toInt(),
+                               values[4].toInt()));
+    }
+  }
+  return areas;
+}
+
+void TileCache::evictIfFull(const QString &path,
+                            const std::shared_ptr<TileIndex> &index) {
+  std::lock_guard<std::mutex> lock(index->mutex);
+  if (index->ready && !index->evicting && index->max_bytes > 0 &&
+      index->bytes > index->max_bytes) {
+    index->evicting = true;
+    QtConcurrent::run(&TileCache::evict, path, index);
+  }
+}
+
+void TileCache::evict(QString path, std::shared_ptr<TileIndex> index) {
+  //  seconds, like the change times of files
+  const qint64 started = QDateTime::currentMSecsSinceEpoch() / 1000;
+  std::vector<TileCoord> victims;
+  {
+    std::lock_guard<std::mutex> lock(index->mutex);
+    if (pinnedModified(path) != index->pinned_modified) {
+      //  pinned by another process, e.g. the seeder, since it was read; read
+      //  under the lock so that no pin() of this process is lost
+      index->repin(loadPinned(path, index->pinned_modified));
+    }
+    const qint64 target =
+        static_cast<qint64>(index->max_bytes * kEvictionTarget);
+    while (index->bytes > target && !index->lru.empty()) {
+      victims.push_back(index->lru.back());
+      index->erase(victims.back());
+    }
+  }
+  for (const TileCoord &tile : victims) {
+    const QString tile_path = pathForTile(path, tile.x, tile.y, tile.z);
+    {
+      //  only the index under the lock, stores and lookups do not wait for
+      //  the disk
+      std::lock_guard<std::mutex> lock(index->mutex);
+      if (index->tiles.count(tile)) {
+        continue; //  stored again since it was picked
+      }
+    }
+    struct stat info;
+    if (::stat(QFile::encodeName(tile_path).constData(), &info) == 0 &&
+        info.st_ctime >= started) {
+      //  written but not indexed yet, or linked to a blob in use again
+      std::lock_guard<std::mutex> lock(index->mutex);
+      if (!index->tiles.count(tile)) {
+        index->insert(tile, info.st_size, true);
+      }
+      continue;
+    }
+    Metadata meta;
+    const bool has_meta = readMetadataFile(tile_path + ".meta", meta);
+    QFile::remove(tile_path);
+    QFile::remove(tile_path + ".meta");
+    QFile::remove(tile_path + kPixelSuffix);
+    if (has_meta && !meta.checksum.isEmpty()) {
+      //  shared blobs are only freed with their last tile
+      releaseBlob(pathForBlob(path, meta.checksum));
+      releaseBlob(pathForBlob(path, meta.checksum) + kPixelSuffix);
+    }
+    if (!QFile::exists(tile_path)) {
+      //  stored again while its files were removed: downloaded again when
+      //  next asked for, rather than looked up in vain
+      std::lock_guard<std::mutex> lock(index->mutex);
+      index->erase(tile);
+    }
+  }
+  ROS_DEBUG("Evicted %zu tiles from %s", victims.size(), qPrintable(path));
+
+  std::lock_guard<std::mutex> lock(index->mutex);
+  index->evicting = false;
+}
+
+void TileCache::migrateFlatLayout(const QString &path) {
+  QDir dir(path);
+  const QStringList names =
+      dir.entryList(QStringList() << "x*_y*_z*.jpg*", QDir::Files);
+  if (names.isEmpty()) {
+    return;
+  }
+  ROS_INFO("Moving %d cached tiles to the {z}/{x}/{y} layout",
+           static_cast<int>(names.size()));
+  for (const QString &name : names) {
+    //  x{X}_y{Y}_z{Z}.jpg, optionally followed by .meta or .missing
+    const int dot = name.indexOf(".jpg");
+    const QStringList coords = name.left(dot).split('_');
+    bool ok_x = false, ok_y = false, ok_z = false;
+    if (dot < 0 || coords.size() != 3) {
+      continue;
+    }
+    const int x = coords[0].mid(1).toInt(&ok_x);
+    const int y = coords[1].mid(1).toInt(&ok_y);
+    const int z = coords[2].mid(1).toInt(&ok_z);
+    if (!ok_x || !ok_y || !ok_z ||
+        !dir.mkpath(QString::number(z) + QDir::separator() +
+                    QString::number(x))) {
+      continue;
+    }
+    const QString from = dir.filePath(name);
+    const QString to = pathForTile(path, x, y, z) + name.mid(dot + 4);
+    if (!QFile::rename(from, to)) {
+      //  already present in the new layout
+      QFile::remove(from);
+    }
+  }
+}
+
+void TileCache::buildIndex(QString path, std::shared_ptr<TileIndex> index,
+                           bool migrate) {
+  if (migrate) {
+    migrateFlatLayout(path);
+  }
+  //  (last use, tile, size)
+  std::vector<std::pair<qint64, std::pair<TileCoord, qint64>>> tiles;
+  TileSet missing;
+  const QDir::Filters subfolders = QDir::Dirs | QDir::NoDotAndDotDot;
+  QDir root(path);
+  for (const QString &z_name : root.entryList(subfolders)) {
+    bool ok_z = false;
+    const int z = z_name.toInt(&ok_z);
+    if (!ok_z) {
+      continue;
+    }
+    QDir z_dir(root.filePath(z_name));
+    for (const QString &x_name : z_dir.entryList(subfolders)) {
+      bool ok_x = false;
+      const int x = x_name.toInt(&ok_x);
+      if (!ok_x) {
+        continue;
+      }
+      QDir x_dir(z_dir.filePath(x_name));
+      for (const QFileInfo &info : x_dir.entryInfoList(QDir::Files)) {
+        //  {y}.jpg, {y}.jpg.meta, {y}.jpg.missing, {y}.jpg.lock, or any of
+        //  them followed by .tmp{pid}_{n} while being written
+        const QString name = info.fileName();
+        const int dot = name.indexOf(".jpg");
+        bool ok_y = false;
+        const int y = name.left(dot).toInt(&ok_y);
+        if (dot <= 0 || !ok_y) {
+          continue;
+        }
+        const QString suffix = name.mid(dot);
+        if (suffix.contains(".tmp")) {
+          //  left behind by a process that died while writing
+          if (info.lastModified().toMSecsSinceEpoch() <
+              QDateTime::currentMSecsSinceEpoch() - kLockTtl * 1000) {
+            QFile::remove(info.filePath());
+          }
+        } else if (suffix == ".jpg") {
+          //  the access time is only updated now and then on most mounts,
+          //  but that is enough to order tiles used on different days
+          const qint64 used =
+              std::max(info.lastRead().toMSecsSinceEpoch(),
+                       info.lastModified().toMSecsSinceEpoch());
+          tiles.push_back(std::make_pair(
+              used, std::make_pair(TileCoord(x, y, z), info.size())));
+        } else if (suffix == ".jpg.missing") {
+          missing.insert(TileCoord(x, y, z));
+        }
+      }
+    }
+  }
+
+  std::sort(tiles.begin(), tiles.end(),
+            [](const std::pair<qint64, std::pair<TileCoord, qint64>> &a,
+               const std::pair<qint64, std::pair<TileCoord, qint64>> &b) {
+              return a.first > b.first;
+            });
+  {
+    std::lock_guard<std::mutex> lock(index->mutex);
+    //  tiles stored while listing are newer, keep them
+    for (const auto &tile : tiles) {
+      if (!index->tiles.count(tile.second.first)) {
+        index->insert(tile.second.first, tile.second.second, true);
+      }
+    }
+    index->missing.insert(missing.begin(), missing.end());
+    index->ready = true;
+    ROS_DEBUG("Indexed %zu cached tiles (%lld bytes) in %s",
+              index->tiles.size(), static_cast<long long>(index->bytes),
+              qPrintable(path));
+  }
+  evictIfFull(path, index);
+}
+
+bool TileCache::storeBlob(const QString &tile_path, const QByteArray &data,
+                          const QString &blob_path) const {
+  const QString temp_path = temporaryPathFor(tile_path);
+  for (int attempt = 0; attempt < 2; attempt++) {
+    //  a blob of the wrong size was cut short, replace it
+    const QFileInfo blob(blob_path);
+    if ((!blob.exists() || blob.size() != data.size()) &&
+        (!QDir(path_).mkpath(blob.path()) ||
+         !writeAtomically(blob_path, data))) {
+      return false;
+    }
+    //  link next to the tile, then rename over it, see writeAtomically()
+    QFile::remove(temp_path);
+    if (::link(QFile::encodeName(blob_path).constData(),
+               QFile::encodeName(temp_path).constData()) == 0) {
+      if (std::rename(QFile::encodeName(temp_path).constData(),
+                      QFile::encodeName(tile_path).constData()) != 0) {
+        QFile::remove(temp_path);
+        return false;
+      }
+      return true;
+    }
+    if (errno != ENOENT) {
+      //  e.g. a filesystem without hard links
+      return false;
+    }
+    //  collected by another process in the meantime, write it again
+  }
+  return false;
+}
+
+void TileCache::releaseBlob(const QString &blob_path) {
+  struct stat info;
+  if (::stat(QFile::encodeName(blob_path).constData(), &info) == 0 &&
+      info.st_nlink <= 1) {
+    QFile::remove(blob_path);
+  }
+}
+
+void TileCache::collectBlobs(const QString &path) {
+  const qint64 expired =
+      QDateTime::currentMSecsSinceEpoch() - kLockTtl * 1000;
+  QDir blobs(QDir(path).filePath(kBlobFolder));
+  for (const QString &prefix :
+       blobs.entryList(QDir::Dirs | QDir::NoDotAndDotDot)) {
+    QDir dir(blobs.filePath(prefix));
+    for (const QFileInfo &info : dir.entryInfoList(QDir::Files)) {
+      //  recent blobs may be about to be linked by another process
+      if (info.lastModified().toMSecsSinceEpoch() >= expired) {
+        continue;
+      }
+      struct stat st;
+      if (::stat(QFile::encodeName(info.filePath()).constData(), &st) == 0 &&
+          st.st_nlink <= 1) {
+        QFile::remove(info.filePath());
+      }
+    }
+  }
+}
+
+bool TileCache::contains(int x, int y, int z) const {
+  {
+    std::lock_guard<std::mutex> lock(index_->mutex);
+    if (index_->ready) {
+      return index_->tiles.count(TileCoord(x, y, z)) > 0;
+    }
+  }
+  return QFile::exists(cachedPathForTile(x, y, z));
+}
+
+QImage TileCache::load(int x, int y, int z, QByteArray *checksum,
+                       int scale) const {
+  QFile file(cachedPathForTile(x, y, z));
+  if (!file.open(QIODevice::ReadOnly)) {
+    return QImage();
+  }
+  const QByteArray data = file.readAll();
+  file.close();
+
+  Metadata meta;
+  const QByteArray actual = TileCache::checksum(data);
+  if (readMetadata(x, y, z, meta) && !meta.checksum.isEmpty() &&
+      actual != meta.checksum) {
+    //  the metadata is replaced before the tile, so a tile older than its
+    //  metadata is being replaced by another process right now
+    if (QFileInfo(cachedPathForTile(x, y, z)).lastModified() <
+        QFileInfo(metadataPathForTile(x, y, z)).lastModified()) {
+      return QImage();
+    }
+    ROS_WARN("Deleting corrupt cached tile %s",
+             qPrintable(cachedPathForTile(x, y, z)));
+    //  the blob is corrupt too, don't link new tiles to it
+    if (!read_only_) {
+      QFile::remove(pathForBlob(path_, meta.checksum));
+    }
+    discard(x, y, z);
+    return QImage();
+  }
+  const QImage image = decodeForUpload(data, scale);
+  if (image.isNull()) {
+    ROS_WARN("Deleting undecodable cached tile %s",
+             qPrintable(cachedPathForTile(x, y, z)));
+    discard(x, y, z);
+    return image;
+  }
+  if (checksum) {
+    *checksum = actual;
+  }
+
+  std::lock_guard<std::mutex> lock(index_->mutex);
+  if (index_->tiles.count(TileCoord(x, y, z))) {
+    index_->touch(TileCoord(x, y, z));
+  } else {
+    //  stored by another process
+    index_->insert(TileCoord(x, y, z), data.size());
+  }
+  return image;
+}
+
+std::shared_ptr<const PixelBlock>
+TileCache::loadPixels(int x, int y, int z, QByteArray *checksum) const {
+  Metadata meta;
+  if (!readMetadata(x, y, z, meta) || meta.checksum.isEmpty()) {
+    return nullptr;
+  }
+  //  pixels of a tile replaced since hold another checksum
+  std::shared_ptr<const PixelBlock> pixels =
+      PixelBlock::map(pixelsPathForTile(x, y, z), meta.checksum);
+  if (!pixels) {
+    return pixels;
+  }
+  if (checksum) {
+    *checksum = meta.checksum;
+  }
+
+  std::lock_guard<std::mutex> lock(index_->mutex);
+  index_->touch(TileCoord(x, y, z));
+  return pixels;
+}
+
+bool TileCache::storePixels(int x, int y, int z, const QByteArray &checksum,
+                            const QImage &image) {
+  if (read_only_ || checksum.isEmpty() || image.isNull() ||
+      !createFolderForTile(x, z)) {
+    return false;
+  }
+  const QString pixels_path = pixelsPathForTile(x, y, z);
+  if (PixelBlock::map(pixels_path, checksum)) {
+    //  stored already, e.g. the tile was decoded from memory
+    return true;
+  }
+  const QByteArray contents = PixelBlock::encode(image, checksum);
+  return storeBlob(pixels_path, contents,
+                   pathForBlob(path_, checksum) + kPixelSuffix) ||
+         writeAtomically(pixels_path, contents);
+}
+
+void TileCache::discard(int x, int y, int z) const {
+  if (read_only_) {
+    return;
+  }
+  Metadata meta;
+  const bool has_meta = readMetadata(x, y, z, meta);
+  QFile::remove(cachedPathForTile(x, y, z));
+  QFile::remove(metadataPathForTile(x, y, z));
+  QFile::remove(pixelsPathForTile(x, y, z));
+  if (has_meta && !meta.checksum.isEmpty()) {
+    releaseBlob(pathForBlob(path_, meta.checksum));
+    releaseBlob(pathForBlob(path_, meta.checksum) + kPixelSuffix);
+  }
+  std::lock_guard<std::mutex> lock(index_->mutex);
+  index_->erase(TileCoord(x, y, z));
+}
+
+TileCache::Metadata TileCache::metadata(int x, int y, int z) const {
+  Metadata meta;
+  if (!readMetadata(x, y, z, meta)) {
+    //  cached before metadata was kept, date it by the file
+    meta.fetched = QFileInfo(cachedPathForTile(x, y, z))
+                       .lastModified()
+                       .toMSecsSinceEpoch();
+  }
+  return meta;
+}
+
+bool TileCache::readMetadata(int x, int y, int z, Metadata &meta) const {
+  return readMetadataFile(metadataPathForTile(x, y, z), meta);
+}
+
+bool TileCache::readMetadataFile(const QString &meta_path, Metadata &meta) {
+  QFile file(meta_path);
+  if (!file.open(QIODevice::ReadOnly)) {
+    return false;
+  }
+  meta = Metadata();
+  //  one "key value" pair per line
+  while (!file.atEnd()) {
+    const QByteArray line = file.readLine().trimmed();
+    const int space = line.indexOf(' ');
+    if (space <= 0) {
+      continue;
+    }
+    const QByteArray key = line.left(space);
+    const QByteArray value = line.mid(space + 1);
+    if (key == "etag") {
+      meta.etag = value;
+    } else if (key == "last-modified") {
+      meta.last_modified = value;
+    } else if (key == "max-age") {
+      meta.max_age = value.toLongLong();
+    } else if (key == "fetched") {
+      meta.fetched = value.toLongLong();
+    } else if (key == "sha1") {
+      meta.checksum = value;
+    }
+  }
+  return true;
+}
+
+bool TileCache::store(int x, int y, int z, const QByteArray &data,
+                      const Metadata &meta) {
+  Metadata previous;
+  const bool replaced = readMetadata(x, y, z, previous);
+  Metadata checked = meta;
+  checked.checksum = checksum(data);
+  //  metadata first, see load()
+  if (!storeMetadata(x, y, z, checked)) {
+    return false;
+  }
+  //  without hard links, every tile keeps its own copy
+  const QString tile_path = cachedPathForTile(x, y, z);
+  if (!storeBlob(tile_path, data, pathForBlob(path_, checked.checksum)) &&
+      !writeAtomically(tile_path, data)) {
+    return false;
+  }
+  if (replaced && !previous.checksum.isEmpty() &&
+      previous.checksum != checked.checksum) {
+    //  the pixels of the previous tile are of no use anymore
+    QFile::remove(pixelsPathForTile(x, y, z));
+    releaseBlob(pathForBlob(path_, previous.checksum));
+    releaseBlob(pathForBlob(path_, previous.checksum) + kPixelSuffix);
+  }
+  QFile::remove(missingPathForTile(x, y, z));
+  {
+    std::lock_guard<std::mutex> lock(index_->mutex);
+    index_->insert(TileCoord(x, y, z), data.size());
+    index_->missing.erase(TileCoord(x, y, z));
+  }
+  evictIfFull(path_, index_);
+  return true;
+}
+
+bool TileCache::storeMetadata(int x, int y, int z, const Metadata &meta) {
+  QByteArray contents;
+  if (!meta.etag.isEmpty()) {
+    contents += "etag " + meta.etag + "\n";
+  }
+  if (!meta.last_modified.isEmpty()) {
+    contents += "last-modified " + meta.last_modified + "\n";
+  }
+  contents += "max-age " + QByteArray::number(meta.max_age) + "\n";
+  contents += "fetched " + QByteArray::number(meta.fetched) + "\n";
+  if (!meta.checksum.isEmpty()) {
+    contents += "sha1 " + meta.checksum + "\n";
+  }
+
+  return !read_only_ && createFolderForTile(x, z) &&
+         writeAtomically(metadataPathForTile(x, y, z), contents);
+}
+
+bool TileCache::markMissing(int x, int y, int z) {
+  const QByteArray now =
+      QByteArray::number(QDateTime::currentMSecsSinceEpoch());
+  if (read_only_ || !createFolderForTile(x, z) ||
+      !writeAtomically(missingPathForTile(x, y, z), now)) {
+    return false;
+  }
+  std::lock_guard<std::mutex> lock(index_->mutex);
+  index_->missing.insert(TileCoord(x, y, z));
+  return true;
+}
+
+bool TileCache::isMissing(int x, int y, int z, qint64 now,
+                          bool shared) const {
+  if (!shared) {
+    std::lock_guard<std::mutex> lock(index_->mutex);
+    if (index_->ready && !index_->missing.count(TileCoord(x, y, z))) {
+      return false;
+    }
+  }
+  QFile file(missingPathForTile(x, y, z));
+  if (!file.open(QIODevice::ReadOnly)) {
+    return false;
+  }
+  const qint64 marked = file.readAll().trimmed().toLongLong();
+  if (now - marked >= kMissingTtl * 1000) {
+    return false;
+  }
+  if (shared) {
+    std::lock_guard<std::mutex> lock(index_->mutex);
+    index_->missing.insert(TileCoord(x, y, z));
+  }
+  return true;
+}
+
+bool TileCache::tryLock(int x, int y, int z) {
+  if (read_only_ || !createFolderForTile(x, z)) {
+    //  nothing will be written, no need to coordinate
+    return true;
+  }
+  const QByteArray path = QFile::encodeName(lockPathForTile(x, y, z));
+  for (int attempt = 0; attempt < 2; attempt++) {
+    //  O_EXCL makes creation atomic, also across processes
+    const int fd = ::open(path.constData(), O_WRONLY | O_CREAT | O_EXCL, 0644);
+    if (fd >= 0) {
+      const QByteArray pid =
+          QByteArray::number(QCoreApplication::applicationPid());
+      const ssize_t written = ::write(fd, pid.constData(), pid.size());
+      ::close(fd);
+      return written == pid.size();
+    }
+    if (errno != EEXIST || isLocked(x, y, z)) {
+      return false;
+    }
+    //  abandoned, e.g. the owner crashed
+    QFile::remove(lockPathForTile(x, y, z));
+  }
+  return false;
+}
+
+bool TileCache::isLocked(int x, int y, int z) const {
+  const QFileInfo info(lockPathForTile(x, y, z));
+  return info.exists() &&
+         info.lastModified().toMSecsSinceEpoch() >=
+             QDateTime::currentMSecsSinceEpoch() - kLockTtl * 1000;
+}
+
+void TileCache::unlock(int x, int y, int z) {
+  if (!read_only_) {
+    QFile::remove(lockPathForTile(x, y, z));
+  }
+}
+
+bool TileCache::createFolderForTile(int x, int z) const {
+  return QDir(path_).mkpath(QString::number(z) + QDir::separator() +
+                            QString::number(x));
+}
+
+QString TileCache::pathForTile(const QString &path, int x, int y, int z) {
+  return QDir::cleanPath(path + QDir::separator() + QString::number(z) +
+                         QDir::separator() + QString::number(x) +
+                         QDir::separator() + QString::number(y) + ".jpg");
+}
+
+QString TileCache::pathForBlob(const QString &path,
+                               const QByteArray &checksum) {
+  //  sharded by the first byte, so that no folder grows too large
+  const QString name = QString::fromLatin1(checksum);
+  return QDir::cleanPath(path + QDir::separator() + kBlobFolder +
+                         QDir::separator() + name.left(2) +
+                         QDir::separator() + name);
+}
+
+QString TileCache::cachedPathForTile(int x, int y, int z) const {
+  return pathForTile(path_, x, y, z);
+}
+
+QString TileCache::pixelsPathForTile(int x, int y, int z) const {
+  return cachedPathForTile(x, y, z) + kPixelSuffix;
+}
+
+QString TileCache::metadataPathForTile(int x, int y, int z) const {
+  return cachedPathForTile(x, y, z) + ".meta";
+}
+
+QString TileCache::missingPathForTile(int x, int y, int z) const {
+  return cachedPathForTile(x, y, z) + ".missing";
+}
+
+QString TileCache::lockPathForTile(int x, int y, int z) const {
+  return cachedPathForTile(x, y, z) + ".lock";
+}
@@ -0,0 +1,324 @@
+/*
+ * TileCache.h
+ *
+ *  Copyright (c) 2014 Gaeth Cross. Apache 2 License.
+ *
+ *  This file is part of rviz_satellite.
+ *
+ *	Created on: 16/10/2026
+ */
+
+#ifndef TILECACHE_H
+#define TILECACHE_H
+
+#include <QByteArray>
+#include <QImage>
+#include <QString>
+#include <memory>
+#include <string>
+#include <vector>
+
+class QNetworkReply;
+struct TileIndex;
+
+/// Coordinates of a tile.
+struct TileCoord {
+  TileCoord(int x, int y, int z) : x(x), y(y), z(z) {}
+
+  bool operator<(const TileCoord &other) const {
+    if (z != other.z) {
+      return z < other.z;
+    }
+    return y != other.y ? y < other.y : x < other.x;
+  }
+  bool operator==(const TileCoord &other) const {
+    return x == other.x && y == other.y && z == other.z;
+  }
+
+  int x;
+  int y;
+  int z;
+};
+
+/// Rectangle of tiles [min_x, max_x] x [min_y, max_y] at zoom level z.
+struct TileArea {
+  TileArea(int z, int min_x, int min_y, int max_x, int max_y)
+      : z(z), min_x(min_x), min_y(min_y), max_x(max_x), max_y(max_y) {}
+
+  bool contains(const TileCoord &tile) const {
+    return tile.z == z && tile.x >= min_x && tile.x <= max_x &&
+           tile.y >= min_y && tile.y <= max_y;
+  }
+
+  int z;
+  int min_x;
+  int min_y;
+  int max_x;
+  int max_y;
+};
+
+/**
+ * @class PixelBlock
+ * @brief Decoded tile, memory-mapped from the cache in the layout
+ * textureFromImage() uploads: 24 bit RGB, bottom row first, rows packed.
+ */
+class PixelBlock {
+public:
+  /// Map the pixel file at `path` if it holds the tile with `checksum`.
+  /// Null if missing or invalid.
+  static std::shared_ptr<const PixelBlock> map(const QString &path,
+                                               const QByteArray &checksum);
+
+  /// Contents of a pixel file holding `image`, with `checksum`.
+  static QByteArray encode(const QImage &image, const QByteArray &checksum);
+
+  ~PixelBlock();
+
+  int width() const { return width_; }
+  int height() const { return height_; }
+
+  /// First byte of the bottom row.
+  const uchar *data() const { return data_; }
+
+  /// Size of the pixels in bytes.
+  qint64 size() const { return static_cast<qint64>(width_) * height_ * 3; }
+
+private:
+  PixelBlock() : mapping_(nullptr), mapping_size_(0), data_(nullptr),
+                 width_(0), height_(0) {}
+  PixelBlock(const PixelBlock &) = delete;
+  PixelBlock &operator=(const PixelBlock &) = delete;
+
+  void *mapping_;
+  std::size_t mapping_size_;
+  const uchar *data_;
+  int width_;
+  int height_;
+};
+
+/**
+ * @class TileCache
+ * @brief On-disk cache of encoded tiles for one tile server.
+ *
+ * Each tile is stored as the bytes received from the server, next to a small
+ * metadata file holding the HTTP validators and freshness lifetime. Tiles are
+ * sharded in {z}/{x}/{y} folders.
+ *
+ * The caches of a folder share an in-memory index of its tiles, built in the
+ * background the first time the folder is opened. Once the index is ready,
+ * looking up a tile that is not cached takes no filesystem access.
+ *
+ * The size of the tiles in a folder can be capped. Tiles are then evicted in
+ * least recently used order on a background thread, except in pinned areas.
+ *
+ * A folder may be shared by several processes. Files are replaced atomically,
+ * tiles are checked against their checksum when loaded, and lock files let
+ * processes avoid downloading the same tile at the same time.
+ *
+ * Identical tiles, e.g. ocean or "no imagery" placeholders, are stored once:
+ * the bytes go to a blob named by their checksum, and each {z}/{x}/{y} file
+ * is a hard link to it. The size limit counts every link to a blob.
+ *
+ * Optionally, decoded tiles are kept next to the encoded ones as pixel files
+ * ({y}.jpg.rgb), which are mapped and uploaded without decoding. They are
+ * shared between identical tiles like the encoded bytes, and are not counted
+ * in the size limit.
+ */
+class TileCache {
+public:
+  /// HTTP caching metadata of a tile.
+  struct Metadata {
+    Metadata() : max_age(-1), fetched(0) {}
+
+    /// Is the tile past its freshness lifetime at time `now` (ms)?
+    bool isStale(qint64 now) const;
+
+    /// Entity tag returned by the server, sent back as If-None-Match.
+    QByteArray etag;
+    /// Last-Modified date, sent back as If-Modified-Since.
+    QByteArray last_modified;
+    /// Freshness lifetime in seconds, negative if unknown.
+    qint64 max_age;
+    /// Time the tile was fetched or last revalidated, ms since epoch.
+    qint64 fetched;
+    /// Hex SHA-1 of the tile, empty if unknown.
+    QByteArray checksum;
+  };
+
+  /// Hex SHA-1 of `data`, identifies tiles by content.
+  static QByteArray checksum(const QByteArray &data);
+
+  /// Replace the file at `path` with `data`, so that readers in any process
+  /// see either the old or the new contents.
+  static bool writeAtomically(const QString &path, const QByteArray &data);
+
+  /// Decode the encoded tile `data` at 1/`scale` of its size. JPEGs are
+  /// reduced by libjpeg while decoding (DCT scaling), for a fraction of the
+  /// cost of a full decode. When built with libjpeg-turbo, JPEGs are decoded
+  /// by it straight to 24 bit RGB, other formats by Qt. Null image if
+  /// unreadable.
+  static QImage decode(const QByteArray &data, int scale = 1);
+
+  /// Decode like decode(), into the layout uploaded to the GPU: 24 bit RGB,
+  /// rows bottom-up. libjpeg-turbo writes JPEGs in that layout directly.
+  static QImage decodeForUpload(const QByteArray &data, int scale = 1);
+
+  /// Is `image` in the layout uploaded to the GPU, see decodeForUpload()?
+  static bool isUploadLayout(const QImage &image);
+
+  /// `image` in the layout uploaded to the GPU, converted unless it is
+  /// already.
+  static QImage toUploadLayout(const QImage &image);
+
+  /// Caching metadata from the headers of `reply`. Validators missing from
+  /// the reply (a 304 may omit them) are taken from `previous`.
+  static Metadata metadataFromReply(const QNetworkReply *reply,
+                                    const Metadata &previous = Metadata());
+
+  /// Tiles cached in the flat x{X}_y{Y}_z{Z}.jpg layout of older versions
+  /// are moved to the sharded layout in the background. A `read_only` cache
+  /// never writes to the folder, which may not exist.
+  /// @throw std::runtime_error if the cache folder cannot be created.
+  TileCache(const std::string &base_path, const std::string &object_uri,
+            bool read_only = false);
+
+  /// Folder holding the tiles of this server.
+  const QString &path() const { return path_; }
+
+  /// Are writes refused?
+  bool readOnly() const { return read_only_; }
+
+  /// Cap the size of the tiles in the folder to `bytes`, 0 for no limit.
+  /// Shared by all caches of the folder.
+  void setMaxSize(qint64 bytes);
+
+  /// Size of the tiles in the folder, as far as indexed.
+  qint64 size() const;
+
+  /// Exempt the tiles in `area` from eviction, persistently.
+  bool pin(const TileArea &area);
+
+  /// Is tile [x,y,z] in the cache?
+  bool contains(int x, int y, int z) const;
+
+  /// Decode cached tile [x,y,z], at 1/`scale` of its size, in the layout
+  /// uploaded to the GPU (see decodeForUpload()). Null image if missing or
+  /// unreadable. Corrupt tiles are deleted. Tiles stored by other processes
+  /// are loaded even if the index does not know them yet. The checksum of
+  /// the tile is written to `checksum`, if given.
+  QImage load(int x, int y, int z, QByteArray *checksum = nullptr,
+              int scale = 1) const;
+
+  /// Pixels of cached tile [x,y,z], if stored with storePixels() since the
+  /// tile last changed. The checksum of the tile is written to `checksum`.
+  std::shared_ptr<const PixelBlock> loadPixels(int x, int y, int z,
+                                               QByteArray *checksum) const;
+
+  /// Store the decoded `image` of tile [x,y,z], whose checksum is
+  /// `checksum`, as a pixel file.
+  bool storePixels(int x, int y, int z, const QByteArray &checksum,
+                   const QImage &image);
+
+  /// Metadata of cached tile [x,y,z]. Tiles cached without metadata are
+  /// dated by their modification time and have an unknown lifetime.
+  Metadata metadata(int x, int y, int z) const;
+
+  /// Read the metadata file of tile [x,y,z] into `meta`, if there is one.
+  /// The tile itself may be in another cache.
+  bool readMetadata(int x, int y, int z, Metadata &meta) const;
+
+  /// Store the encoded tile [x,y,z] along with its metadata. The checksum
+  /// is computed from `data`, and tiles with the same checksum share a blob.
+  bool store(int x, int y, int z, const QByteArray &data,
+             const Metadata &meta);
+
+  /// Replace the metadata of tile [x,y,z], e.g. after revalidation.
+  bool storeMetadata(int x, int y, int z, const Metadata &meta);
+
+  /// Record that the server does not have tile [x,y,z].
+  bool markMissing(int x, int y, int z);
+
+  /// Was tile [x,y,z] recently found missing on the server? With `shared`,
+  /// the marker is read even if the index does not list it, e.g. because
+  /// another process just wrote it.
+  bool isMissing(int x, int y, int z, qint64 now, bool shared = false) const;
+
+  /// Claim the download of tile [x,y,z] for this process. False if another
+  /// process is downloading it. Abandoned claims expire after a while.
+  bool tryLock(int x, int y, int z);
+
+  /// Is another process downloading tile [x,y,z]?
+  bool isLocked(int x, int y, int z) const;
+
+  /// Release a claim taken with tryLock().
+  void unlock(int x, int y, int z);
+
+private:
+  /// Move the tiles in folder `path` from the flat layout to the sharded
+  /// one.
+  static void migrateFlatLayout(const QString &path);
+
+  /// Link the file at `tile_path` to the blob at `blob_path` holding `data`,
+  /// storing the blob first if needed. False if hard links are not supported.
+  bool storeBlob(const QString &tile_path, const QByteArray &data,
+                 const QString &blob_path) const;
+
+  /// Delete the blob at `blob_path` if no tile links to it.
+  static void releaseBlob(const QString &blob_path);
+
+  /// Read the metadata file at `meta_path` into `meta`, if there is one.
+  static bool readMetadataFile(const QString &meta_path, Metadata &meta);
+
+  /// Delete the blobs under `path` no tile links to anymore.
+  static void collectBlobs(const QString &path);
+
+  /// List the tiles and negative entries under `path` into `index`, after
+  /// migrating the flat layout if `migrate`.
+  static void buildIndex(QString path, std::shared_ptr<TileIndex> index,
+                         bool migrate);
+
+  /// Read the pinned areas of the folder `path`, and the modification time
+  /// of their file into `modified` (ms).
+  static std::vector<TileArea> loadPinned(const QString &path,
+                                          qint64 &modified);
+
+  /// Start evicting tiles in the background if over the size limit.
+  static void evictIfFull(const QString &path,
+                          const std::shared_ptr<TileIndex> &index);
+
+  /// Delete least recently used tiles until below the size limit.
+  static void evict(QString path, std::shared_ptr<TileIndex> index);
+
+  /// File path for tile [x,y,z] in cache folder `path`.
+  static QString pathForTile(const QString &path, int x, int y, int z);
+
+  /// Create the folder of tiles in column `x` at zoom `z`.
+  bool createFolderForTile(int x, int z) const;
+
+  /// Delete tile [x,y,z] and its metadata.
+  void discard(int x, int y, int z) const;
+
+  /// File path for blob `checksum` in cache folder `path`.
+  static QString pathForBlob(const QString &path, const QByteArray &checksum);
+
+  /// Get file path for cached tile [x,y,z].
+  QString cachedPathForTile(int x, int y, int z) const;
+
+  /// Get file path for the pixels of tile [x,y,z].
+  QString pixelsPathForTile(int x, int y, int z) const;
+
+  /// Get file path for the metadata of tile [x,y,z].
+  QString metadataPathForTile(int x, int y, int z) const;
+
+  /// Get file path for the negative cache entry of tile [x,y,z].
+  QString missingPathForTile(int x, int y, int z) const;
+
+  /// Get file path for the download lock of tile [x,y,z].
+  QString lockPathForTile(int x, int y, int z) const;
+
+  QString path_;
+  bool read_only_;
+  std::shared_ptr<TileIndex> index_;
+};
+
+#endif // TILECACHE_H
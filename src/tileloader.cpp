@@ -9,21 +9,75 @@
  */
 
 #include "tileloader.h"
+#include "latency_tracker.h"
+#include "concurrency_controller.h"
+#include "progressive_jpeg.h"
+#include "redirect_rules.h"
 
 #include <QUrl>
 #include <QNetworkRequest>
 #include <QNetworkProxy>
 #include <QVariant>
-#include <QDir>
-#include <QFile>
+#include <QDateTime>
 #include <QImage>
+#include <QBuffer>
 #include <QImageReader>
+#include <QtConcurrentRun>
 #include <stdexcept>
 #include <boost/regex.hpp>
 #include <ros/ros.h>
 #include <ros/package.h>
-#include <functional> // for std::hash
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <limits>
+#include <map>
+#include <mutex>
 
+// Latency percentile above which a request is hedged.
+static constexpr double kHedgePercentile = 0.95;
+// Number of latency samples required before hedging kicks in.
+static constexpr std::size_t kHedgeMinSamples = 20;
+// Never hedge requests younger than this (ms).
+static constexpr double kHedgeMinDelayMs = 200;
+// Max fraction of extra requests added by hedging.
+static constexpr double kMaxHedgeFraction = 0.1;
+// Interval at which in-flight requests are checked for hedging (ms).
+static constexpr int kHedgeCheckIntervalMs = 50;
+// Interval at which tiles downloaded by another process are checked on (ms).
+static constexpr int kLockPollIntervalMs = 500;
+// Max number of decoded tiles waiting for the render thread.
+static constexpr std::size_t kOutputCapacity = 64;
+// Interval at which decoding resumes once the output queue was full (ms).
+static constexpr int kDecodeRetryIntervalMs = 20;
+// Strongest reduction of far tiles, the most libjpeg does while decoding.
+static constexpr int kMaxDecodeScale = 8;
+// Size of the tiles cut from WMS images (px).
+static constexpr int kWmsTileSize = 256;
+// Side of the chunks of the window requested from WMS servers at once
+// (tiles), 2048 px fits the size limit of most servers.
+static constexpr int kWmsChunkTiles = 8;
+// Half the circumference of the earth in EPSG:3857 (m).
+static constexpr double kMercatorHalfExtent = 20037508.342789244;
+
+// Permanent redirects learned from servers, shared by all loaders.
+static RedirectRules learned_redirects;
+
+namespace {
+/// Download of a tile by one loader, which other loaders wait for.
+struct SharedDownload {
+  SharedDownload() : owner(nullptr) {}
+
+  TileLoader *owner;
+  std::vector<TileLoader *> waiters;
+};
+} // namespace
+
+// Downloads in progress by object URI and tile, so that loaders of several
+// displays, or successive loaders of one, send a single request per tile.
+static std::mutex shared_downloads_mutex;
+static std::map<std::pair<std::string, TileCoord>, SharedDownload>
+    shared_downloads;
 
 static size_t replaceRegex(const boost::regex &ex, std::string &str,
                            const std::string &replace) {
@@ -39,52 +93,86 @@ static size_t replaceRegex(const boost::regex &ex, std::string &str,
   return count;
 }
 
-void TileLoader::MapTile::abortLoading() {
+// Placeholders of object URIs, substituted for every tile URI.
+static const boost::regex kPlaceholderX("\\{x\\}", boost::regex::icase);
+static const boost::regex kPlaceholderY("\\{y\\}", boost::regex::icase);
+static const boost::regex kPlaceholderZ("\\{z\\}", boost::regex::icase);
+static const boost::regex kPlaceholderBbox("\\{bbox\\}", boost::regex::icase);
+static const boost::regex kPlaceholderWidth("\\{width\\}",
+                                            boost::regex::icase);
+static const boost::regex kPlaceholderHeight("\\{height\\}",
+                                             boost::regex::icase);
+
+void TileLoader::MapTile::setReply(QNetworkReply *reply) {
+  reply_ = reply;
   if (reply_) {
-    reply_->abort();
-    reply_ = nullptr;
+    request_time_.start();
+  }
+}
+
+void TileLoader::MapTile::setHedgeReply(QNetworkReply *reply) {
+  hedge_reply_ = reply;
+  if (hedge_reply_) {
+    hedged_ = true;
+    hedge_time_.start();
+  }
+}
+
+void TileLoader::MapTile::replaceReply(const QNetworkReply *from,
+                                       QNetworkReply *to) {
+  if (reply_ == from) {
+    reply_ = to;
+  } else if (hedge_reply_ == from) {
+    hedge_reply_ = to;
   }
 }
 
-bool TileLoader::MapTile::hasImage() const { return !image_.isNull(); }
+void TileLoader::MapTile::abortLoading() {
+  //  abort() emits finished() synchronously, so forget the replies first
+  QNetworkReply *reply = reply_;
+  QNetworkReply *hedge_reply = hedge_reply_;
+  reply_ = nullptr;
+  hedge_reply_ = nullptr;
+  if (reply) {
+    reply->abort();
+  }
+  if (hedge_reply) {
+    hedge_reply->abort();
+  }
+}
 
 TileLoader::TileLoader(const std::string &service, double latitude,
                        double longitude, unsigned int zoom, unsigned int blocks,
                        const std::string &proxy,  const std::string &cache_base_path,
+                       const std::vector<std::string> &base_cache_paths,
                        bool offline_mode,
                        QObject *parent)
     : QObject(parent), latitude_(latitude), longitude_(longitude), zoom_(zoom),
       blocks_(blocks),  object_uri_(service), proxy_(proxy),
-      cache_path_(),  offline_mode_(offline_mode) {
+      cache_(new LayeredTileCache(cache_base_path, base_cache_paths, service)),
+      offline_mode_(offline_mode),
+      pixel_cache_(false), detail_blocks_(-1),
+      min_x_(0), min_y_(0), columns_(0), rows_(0), unresolved_(0),
+      wms_chunks_(isWms(service)), hedging_enabled_(false),
+      hedge_timer_(new QTimer(this)), requests_sent_(0), hedges_sent_(0),
+      lock_timer_(new QTimer(this)), decode_timer_(new QTimer(this)),
+      output_(new OutputQueue(kOutputCapacity)), in_flight_(0), last_limit_(0) {
   assert(blocks_ >= 0);
+  //  signals may be queued to another thread
+  qRegisterMetaType<QNetworkRequest>("QNetworkRequest");
 
-  std::hash<std::string> hash_fn;
-  cache_path_ =
-      QDir::cleanPath(QString::fromStdString(cache_base_path) + QDir::separator() +
-                      QString::number(hash_fn(object_uri_)));
-
-  QDir dir(cache_path_);
-  if (!dir.exists() && !dir.mkpath(".")) {
-    throw std::runtime_error("Failed to create cache folder: " +
-                             cache_path_.toStdString());
-  }
-
-
+  hedge_timer_->setInterval(kHedgeCheckIntervalMs);
+  QObject::connect(hedge_timer_, SIGNAL(timeout()), this,
+                   SLOT(hedgeSlowRequests()));
+  lock_timer_->setInterval(kLockPollIntervalMs);
+  QObject::connect(lock_timer_, SIGNAL(timeout()), this,
+                   SLOT(pollLockedTiles()));
+  decode_timer_->setInterval(kDecodeRetryIntervalMs);
+  QObject::connect(decode_timer_, SIGNAL(timeout()), this,
+                   SLOT(pumpDecoding()));
 
   // Override proxy if specified
-  QString proxy_uri = QString::fromStdString(proxy_);
-  QStringList kStr = proxy_uri.split(':');
-
-  if(kStr.size() == 2) {
-    _localhostProxy = QNetworkProxy(QNetworkProxy::HttpProxy, kStr[0], kStr[1].toUInt());
-
-    QString hostname = _localhostProxy.hostName();
-    QString port =  QString::number(_localhostProxy.port());
-    ROS_DEBUG("Proxy initialized to %s:%s",hostname.toStdString().c_str(), port.toStdString().c_str());
-
-  } else {
-    _localhostProxy = QNetworkProxy(QNetworkProxy::HttpProxy, QString(), 0);
-  }
+  _localhostProxy = proxyFromString(proxy_);
 
   /// @todo: some kind of error checking of the URL
 
@@ -96,6 +184,49 @@ TileLoader::TileLoader(const std::string &service, double latitude,
   //  fractional component
   origin_offset_x_ = x - center_tile_x_;
   origin_offset_y_ = y - center_tile_y_;
+
+  //  determine what range of tiles we can load
+  min_x_ = std::max(0, center_tile_x_ - blocks_);
+  min_y_ = std::max(0, center_tile_y_ - blocks_);
+  columns_ = std::min(maxTiles(), center_tile_x_ + blocks_) - min_x_ + 1;
+  rows_ = std::min(maxTiles(), center_tile_y_ + blocks_) - min_y_ + 1;
+}
+
+QNetworkProxy TileLoader::proxyFromString(const std::string &proxy) {
+  QString proxy_uri = QString::fromStdString(proxy);
+  QStringList kStr = proxy_uri.split(':');
+
+  if(kStr.size() == 2) {
+    QNetworkProxy result(QNetworkProxy::HttpProxy, kStr[0], kStr[1].toUInt());
+
+    QString hostname = result.hostName();
+    QString port =  QString::number(result.port());
+    ROS_DEBUG("Proxy initialized to %s:%s",hostname.toStdString().c_str(), port.toStdString().c_str());
+    return result;
+  }
+  return QNetworkProxy(QNetworkProxy::HttpProxy, QString(), 0);
+}
+
+void TileLoader::applyProxy(QNetworkAccessManager *qnam,
+                            const QNetworkProxy &proxy) {
+  if(!proxy.hostName().isEmpty()) {
+    qnam->proxyFactory()->setUseSystemConfiguration ( false );
+    qnam->setProxy(proxy);
+
+    QString hostname = proxy.hostName();
+    QString port =  QString::number(proxy.port());
+    ROS_DEBUG("Proxy updated to %s:%s",hostname.toStdString().c_str(), port.toStdString().c_str());
+
+  } else {
+    qnam->proxyFactory()->setUseSystemConfiguration ( true );
+  }
+}
+
+QNetworkRequest TileLoader::requestForUri(const QUrl &uri) {
+  QNetworkRequest request = QNetworkRequest(uri);
+  auto const userAgent = QByteArray("rviz_satellite/0.0.2 (+https://github.com/gareth-cross/rviz_satellite)");
+  request.setRawHeader(QByteArray("User-Agent"), userAgent);
+  return request;
 }
 
 bool TileLoader::insideCentreTile(double lat, double lon) const {
@@ -104,65 +235,517 @@ bool TileLoader::insideCentreTile(double lat, double lon) const {
   return (std::floor(x) == center_tile_x_ && std::floor(y) == center_tile_y_);
 }
 
+TileLoader::~TileLoader() {
+  releaseLocks();
+  leaveDownloads();
+}
+
 void TileLoader::start() {
+  QMetaObject::invokeMethod(this, "load", Qt::QueuedConnection);
+}
+
+void TileLoader::load() {
   //  discard previous set of tiles and all pending requests
-  abort();
+  abortRequests();
+  requests_sent_ = 0;
+  hedges_sent_ = 0;
+  in_flight_ = 0;
 
   ROS_DEBUG("loading %d blocks around tile=(%d,%d)", blocks_, center_tile_x_, center_tile_y_ );
 
-  qnam_.reset( new QNetworkAccessManager(this) );
+  //  requests of the previous window still needed are kept, and come with
+  //  its network access manager
+  std::shared_ptr<TileLoader> previous;
+  previous.swap(previous_);
+  if (previous && !canAdopt(*previous)) {
+    previous->abortRequests();
+    previous.reset();
+  }
+  if (previous) {
+    qnam_.swap(previous->qnam_);
+    QObject::disconnect(qnam_.get(), nullptr, previous.get(), nullptr);
+    qnam_->setParent(this);
+  } else {
+    qnam_.reset( new QNetworkAccessManager(this) );
+    applyProxy(qnam_.get(), _localhostProxy);
+  }
   QObject::connect(qnam_.get(), SIGNAL(finished(QNetworkReply *)), this,
                    SLOT(finishedRequest(QNetworkReply *)));
 
+  //  downloaded tiles of the previous window waiting to be decoded
+  std::unordered_map<std::size_t, DecodeJob> downloaded;
+  if (previous) {
+    for (const DecodeJob &job : previous->decode_jobs_) {
+      if (!job.data.isEmpty()) {
+        downloaded.insert(std::make_pair(job.index, job));
+      }
+    }
+  }
 
-  if(!_localhostProxy.hostName().isEmpty()) {
-    qnam_->proxyFactory()->setUseSystemConfiguration ( false );
-    qnam_->setProxy(_localhostProxy);
+  const int max_x = min_x_ + columns_ - 1;
+  const int max_y = min_y_ + rows_ - 1;
+  tiles_.reserve(columns_ * rows_);
+  unresolved_ = 0;
 
-    QString hostname = _localhostProxy.hostName();
-    QString port =  QString::number(_localhostProxy.port());
-    ROS_DEBUG("Proxy updated to %s:%s",hostname.toStdString().c_str(), port.toStdString().c_str());
+  //  initiate requests
+  const qint64 now = QDateTime::currentMSecsSinceEpoch();
+  std::vector<std::size_t> stale;
+  for (int y = min_y_; y <= max_y; y++) {
+    for (int x = min_x_; x <= max_x; x++) {
+      if (previous && previous->inWindow(x, y) &&
+          adoptTile(*previous, previous->indexOf(x, y), downloaded)) {
+        //  still loading, or waiting to be decoded
+        continue;
+      }
+      // Check if tile is already in the cache
+      if (cache_->contains(x, y, zoom_)) {
+        //  serve stale tiles right away, revalidate them in the background
+        if (!offline_mode_ && cache_->metadata(x, y, zoom_).isStale(now)) {
+          stale.push_back(tiles_.size());
+        }
+        //  decoded as the render thread keeps up, see pumpDecoding()
+        decode_jobs_.push_back(DecodeJob(tiles_.size()));
+        tiles_.push_back(MapTile(x, y, zoom_));
+        tiles_.back().setHasImage(true);
+      } else if (offline_mode_ || cache_->isMissing(x, y, zoom_, now)) {
+        //  not cached in offline mode, or known to be missing on the server:
+        //  don't ask for now
+        MapTile tile(x, y, zoom_);
+        tile.setMissing(true);
+        tiles_.push_back(tile);
+      } else {
+        //  requested once a slot is available
+        pending_.push_back(tiles_.size());
+        tiles_.push_back(MapTile(x, y, zoom_));
+        unresolved_++;
+      }
+    }
+  }
 
-  } else {
-    qnam_->proxyFactory()->setUseSystemConfiguration ( true );
+  if (previous) {
+    //  cancel the requests for tiles out of the window
+    ROS_DEBUG("took over %d requests of the previous window", in_flight_);
+    previous->abortRequests();
   }
 
-  //  determine what range of tiles we can load
-  const int min_x = std::max(0, center_tile_x_ - blocks_);
-  const int min_y = std::max(0, center_tile_y_ - blocks_);
-  const int max_x = std::min(maxTiles(), center_tile_x_ + blocks_);
-  const int max_y = std::min(maxTiles(), center_tile_y_ + blocks_);
+  //  revalidations go after the missing tiles
+  pending_.insert(pending_.end(), stale.begin(), stale.end());
+  pumpDecoding();
+  dispatchPending();
 
-  //  initiate requests
-  for (int y = min_y; y <= max_y; y++) {
-    for (int x = min_x; x <= max_x; x++) {
-      // Generate filename
-      const QString full_path = cachedPathForTile(x, y, zoom_);
+  if (!checkIfLoadingComplete() && hedging_enabled_) {
+    hedge_timer_->start();
+  }
+}
 
-      // Check if tile is already in the cache
-      QFile tile(full_path);
-      if (tile.exists()) {
-        QImage image(full_path);
-        tiles_.push_back(MapTile(x, y, zoom_, image));
-      } else {
+void TileLoader::setLatencyTracker(
+    const std::shared_ptr<LatencyTracker> &tracker) {
+  latency_tracker_ = tracker;
+}
 
-        if(!offline_mode_) {
-          const QUrl uri = uriForTile(x, y);
-          //  send request
-          QNetworkRequest request = QNetworkRequest(uri);
-          auto const userAgent = QByteArray("rviz_satellite/0.0.2 (+https://github.com/gareth-cross/rviz_satellite)");
-          request.setRawHeader(QByteArray("User-Agent"), userAgent);
-          QNetworkReply *rep = qnam_->get(request);
-          emit initiatedRequest(request);
-          tiles_.push_back(MapTile(x, y, zoom_, rep));
-        }
-      }
+void TileLoader::setHedging(bool enabled, const std::string &mirror_uri) {
+  QMetaObject::invokeMethod(this, "applyHedging", Qt::QueuedConnection,
+                            Q_ARG(bool, enabled),
+                            Q_ARG(QString, QString::fromStdString(mirror_uri)));
+}
+
+void TileLoader::applyHedging(bool enabled, QString mirror_uri) {
+  hedging_enabled_ = enabled;
+  hedge_uri_ = mirror_uri.toStdString();
+  if (!hedging_enabled_) {
+    hedge_timer_->stop();
+  } else if (qnam_ && !tiles_.empty()) {
+    hedge_timer_->start();
+  }
+}
+
+void TileLoader::setPrevious(const std::shared_ptr<TileLoader> &previous) {
+  previous_ = previous;
+}
+
+bool TileLoader::canAdopt(const TileLoader &previous) const {
+  //  same server, reached the same way, and same tiles
+  return !offline_mode_ && previous.qnam_ && previous.zoom_ == zoom_ &&
+         previous.object_uri_ == object_uri_ && previous.proxy_ == proxy_ &&
+         previous.cache_->path() == cache_->path();
+}
+
+bool TileLoader::adoptTile(
+    TileLoader &previous, std::size_t from,
+    std::unordered_map<std::size_t, DecodeJob> &downloaded) {
+  if (from >= previous.tiles_.size()) {
+    return false; //  the previous window never loaded
+  }
+  MapTile &old = previous.tiles_[from];
+  const auto job = downloaded.find(from);
+  if ((!old.isLoading() || old.inChunk()) && job == downloaded.end()) {
+    //  chunks cover the previous window, their tiles are requested again
+    return false;
+  }
+
+  const std::size_t index = tiles_.size();
+  tiles_.push_back(old);
+  const MapTile &tile = tiles_.back();
+  for (const QNetworkReply *reply : {tile.reply(), tile.hedgeReply()}) {
+    if (reply) {
+      previous.replies_.erase(reply);
+      previous.in_flight_--;
+      replies_[reply] = index;
+      in_flight_++;
+      //  previews of the bytes still to come, see sendRequest()
+      QObject::disconnect(reply, nullptr, &previous, nullptr);
+      QObject::connect(reply, SIGNAL(readyRead()), this,
+                       SLOT(receivedData()));
+    }
+  }
+  if (tile.isLoading() && !tile.hasImage()) {
+    //  loaders waiting for the download now wait for this one
+    std::lock_guard<std::mutex> lock(shared_downloads_mutex);
+    const auto it = shared_downloads.find(
+        std::make_pair(object_uri_, TileCoord(tile.x(), tile.y(), tile.z())));
+    if (it != shared_downloads.end() && it->second.owner == &previous) {
+      it->second.owner = this;
+    }
+  }
+  //  the previous loader must neither abort nor unlock it
+  old = MapTile(old.x(), old.y(), old.z());
+
+  if (job != downloaded.end()) {
+    decode_jobs_.push_back(
+        DecodeJob(index, job->second.data, job->second.checksum));
+    downloaded.erase(job);
+  } else if (tile.hasImage()) {
+    //  being revalidated, serve the cached tile meanwhile
+    decode_jobs_.push_back(DecodeJob(index));
+  }
+  if (!tile.hasImage()) {
+    unresolved_++;
+  }
+  return true;
+}
+
+void TileLoader::setConcurrencyController(
+    const std::shared_ptr<ConcurrencyController> &controller) {
+  concurrency_ = controller;
+}
+
+void TileLoader::dispatchPending() {
+  if (!qnam_) {
+    return;
+  }
+  const int limit =
+      concurrency_ ? concurrency_->limit() : std::numeric_limits<int>::max();
+  if (concurrency_ && limit != last_limit_) {
+    last_limit_ = limit;
+    emit concurrencyChanged(limit);
+  }
+  while (!pending_.empty() && in_flight_ < limit) {
+    const std::size_t index = pending_.front();
+    pending_.pop_front();
+    if (!claimDownload(index)) {
+      continue;
+    }
+    MapTile &tile = tiles_[index];
+    if (tile.hasImage()) {
+      const TileCache::Metadata meta =
+          cache_->metadata(tile.x(), tile.y(), tile.z());
+      tile.setReply(sendRequest(index, uriForTile(tile.x(), tile.y()), &meta));
+    } else if (wms_chunks_) {
+      sendChunk(index);
+    } else {
+      tile.setReply(sendRequest(index, uriForTile(tile.x(), tile.y())));
+    }
+    requests_sent_++;
+  }
+}
+
+bool TileLoader::claimDownload(std::size_t index) {
+  MapTile &tile = tiles_[index];
+  if (tile.isLoading() || tile.isWaiting()) {
+    //  queued twice, see pumpDecoding()
+    return false;
+  }
+  if (tile.hasImage()) {
+    return true; //  revalidated without a lock
+  }
+  if (joinDownload(tile)) {
+    //  another loader is on it, see finishedSharedDownload()
+    return false;
+  }
+  if (!cache_->tryLock(tile.x(), tile.y(), tile.z())) {
+    //  another process is downloading it, wait for it to be cached
+    locked_.push_back(index);
+    lock_timer_->start();
+    return false;
+  }
+  return true;
+}
+
+void TileLoader::pollLockedTiles() {
+  std::deque<std::size_t> locked;
+  locked.swap(locked_);
+  bool resolved = false;
+  for (const std::size_t index : locked) {
+    MapTile &tile = tiles_[index];
+    if (!output_->tryReserve()) {
+      //  the render thread is behind, look again later
+      locked_.push_back(index);
+      continue;
+    }
+    DecodedTile decoded(tile.x(), tile.y());
+    decoded.image =
+        cache_->loadShared(tile.x(), tile.y(), tile.z(), &decoded.checksum);
+    if (!decoded.image.isNull()) {
+      output_->push(std::move(decoded));
+      tile.setHasImage(true);
+      unresolved_--;
+      resolved = true;
+      finishDownload(tile, kCached);
+      continue;
+    }
+    output_->release();
+    if (cache_->isLocked(tile.x(), tile.y(), tile.z())) {
+      locked_.push_back(index);
+    } else if (cache_->isMissingShared(tile.x(), tile.y(), tile.z(),
+                                       QDateTime::currentMSecsSinceEpoch())) {
+      //  released without a tile, the server does not have it
+      tile.setMissing(true);
+      unresolved_--;
+      resolved = true;
+      finishDownload(tile, kMissing);
+    } else {
+      //  released without a tile, the download failed
+      pending_.push_front(index);
+    }
+  }
+  if (locked_.empty()) {
+    lock_timer_->stop();
+  }
+  dispatchPending();
+  if (resolved) {
+    checkIfLoadingComplete();
+  }
+}
+
+void TileLoader::releaseLocks() {
+  for (const MapTile &tile : tiles_) {
+    //  tiles with an image are revalidated without a lock
+    if (tile.isLoading() && !tile.hasImage()) {
+      cache_->unlock(tile.x(), tile.y(), tile.z());
+    }
+  }
+}
+
+void TileLoader::reportToController(const QNetworkReply *reply,
+                                    qint64 latency, qint64 bytes) {
+  if (!concurrency_) {
+    return;
+  }
+  const int status =
+      reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+  if (reply->error() == QNetworkReply::NoError) {
+    concurrency_->onSuccess(latency, bytes);
+  } else if (status == 429 || status >= 500 ||
+             (status == 0 &&
+              reply->error() != QNetworkReply::OperationCanceledError)) {
+    //  throttled, server overloaded, or transport failure (timeouts, resets)
+    concurrency_->onError();
+  }
+}
+
+QNetworkReply *TileLoader::sendRequest(std::size_t index, const QUrl &uri,
+                                       const TileCache::Metadata *validators) {
+  QNetworkRequest request = requestForUri(uri);
+  if (validators) {
+    if (!validators->etag.isEmpty()) {
+      request.setRawHeader(QByteArray("If-None-Match"), validators->etag);
+    }
+    if (!validators->last_modified.isEmpty()) {
+      request.setRawHeader(QByteArray("If-Modified-Since"),
+                           validators->last_modified);
+    }
+    request.setPriority(QNetworkRequest::LowPriority);
+  }
+  QNetworkReply *rep = qnam_->get(request);
+  QObject::connect(rep, SIGNAL(readyRead()), this, SLOT(receivedData()));
+  replies_[rep] = index;
+  in_flight_++;
+  emit initiatedRequest(request);
+  return rep;
+}
+
+void TileLoader::sendChunk(std::size_t first) {
+  const MapTile &tile = tiles_[first];
+  //  chunks are aligned on the window, so that small windows take one
+  const int chunk_x =
+      min_x_ + (tile.x() - min_x_) / kWmsChunkTiles * kWmsChunkTiles;
+  const int chunk_y =
+      min_y_ + (tile.y() - min_y_) / kWmsChunkTiles * kWmsChunkTiles;
+  const TileArea bounds(zoom_, chunk_x, chunk_y, chunk_x + kWmsChunkTiles - 1,
+                        chunk_y + kWmsChunkTiles - 1);
+
+  WmsChunk chunk(TileArea(zoom_, tile.x(), tile.y(), tile.x(), tile.y()));
+  chunk.indices.push_back(first);
+  for (auto it = pending_.begin(); it != pending_.end();) {
+    const std::size_t index = *it;
+    const MapTile &other = tiles_[index];
+    //  revalidations are sent one by one, with their validators
+    if (other.hasImage() ||
+        !bounds.contains(TileCoord(other.x(), other.y(), zoom_))) {
+      ++it;
+      continue;
+    }
+    it = pending_.erase(it);
+    if (claimDownload(index)) {
+      chunk.indices.push_back(index);
+      chunk.area.min_x = std::min(chunk.area.min_x, other.x());
+      chunk.area.min_y = std::min(chunk.area.min_y, other.y());
+      chunk.area.max_x = std::max(chunk.area.max_x, other.x());
+      chunk.area.max_y = std::max(chunk.area.max_y, other.y());
+    }
+  }
+  if (chunk.indices.size() == 1) {
+    //  nothing to share the request with
+    tiles_[first].setReply(sendRequest(first, uriForTile(tile.x(), tile.y())));
+    return;
+  }
+
+  chunk.request = requestForUri(uriForArea(object_uri_, chunk.area));
+  QNetworkReply *rep = qnam_->get(chunk.request);
+  for (const std::size_t index : chunk.indices) {
+    tiles_[index].setInChunk(true);
+  }
+  chunk.time.start();
+  chunks_.insert(std::make_pair(rep, chunk));
+  in_flight_++;
+  ROS_DEBUG("Requesting %zu tiles in one WMS request", chunk.indices.size());
+  emit initiatedRequest(chunk.request);
+}
+
+void TileLoader::finishedChunk(QNetworkReply *reply) {
+  const auto it = chunks_.find(reply);
+  WmsChunk chunk = it->second;
+  chunks_.erase(it);
+  in_flight_--;
+  const QByteArray data = reply->readAll();
+  reportToController(reply, chunk.time.elapsed(), data.size());
+  reply->deleteLater();
+
+  const int status =
+      reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+  if (reply->error() == QNetworkReply::NoError) {
+    //  decoded and cut on the thread pool, the image may be 2048 px wide
+    chunk.meta = TileCache::metadataFromReply(reply);
+    std::vector<TileCoord> tiles;
+    for (const std::size_t index : chunk.indices) {
+      tiles.push_back(
+          TileCoord(tiles_[index].x(), tiles_[index].y(), tiles_[index].z()));
     }
+    QFutureWatcher<ChunkParts> *watcher = new QFutureWatcher<ChunkParts>(this);
+    QObject::connect(watcher, SIGNAL(finished()), this,
+                     SLOT(finishedSplit()));
+    splits_.insert(std::make_pair(watcher, chunk));
+    watcher->setFuture(QtConcurrent::run(&TileLoader::splitChunk, data,
+                                         chunk.area, tiles));
+    return;
+  }
+  if (status == 400 || status == 413 || status == 414) {
+    //  the image or its URI is larger than the server allows
+    rejectChunk(chunk);
+    return;
+  }
+
+  //  timeouts, throttling, server failures or a missing layer say nothing
+  //  about chunks: the tiles fail as a request for each would
+  const QString err = "Failed loading " + chunk.request.url().toString() +
+                      " with code " + QString::number(reply->error());
+  emit errorOcurred(err);
+  for (const std::size_t index : chunk.indices) {
+    MapTile &tile = tiles_[index];
+    tile.setInChunk(false);
+    unresolved_--;
+    cache_->unlock(tile.x(), tile.y(), tile.z());
+    finishDownload(tile, kFailed);
+  }
+  dispatchPending();
+  checkIfLoadingComplete();
+}
+
+TileLoader::ChunkParts TileLoader::splitChunk(QByteArray data, TileArea area,
+                                              std::vector<TileCoord> tiles) {
+  ChunkParts parts;
+  //  servers report errors as XML documents, which fail to decode
+  const QImage image = TileCache::decode(data);
+  if (image.width() != (area.max_x - area.min_x + 1) * kWmsTileSize ||
+      image.height() != (area.max_y - area.min_y + 1) * kWmsTileSize) {
+    return parts;
+  }
+  for (const TileCoord &tile : tiles) {
+    ChunkPart part;
+    part.image = image.copy((tile.x - area.min_x) * kWmsTileSize,
+                            (tile.y - area.min_y) * kWmsTileSize,
+                            kWmsTileSize, kWmsTileSize);
+    //  re-encoded, the cache and other loaders deal in encoded tiles; as
+    //  PNG, so that a cached tile shows the pixels the server sent
+    QBuffer buffer(&part.data);
+    buffer.open(QIODevice::WriteOnly);
+    part.image.save(&buffer, "PNG");
+    part.checksum = TileCache::checksum(part.data);
+    parts.push_back(part);
+  }
+  return parts;
+}
+
+void TileLoader::finishedSplit() {
+  QFutureWatcher<ChunkParts> *watcher =
+      static_cast<QFutureWatcher<ChunkParts> *>(sender());
+  watcher->deleteLater();
+  const auto it = splits_.find(watcher);
+  if (it == splits_.end()) {
+    return; //  aborted meanwhile
+  }
+  const WmsChunk chunk = it->second;
+  splits_.erase(it);
+  const ChunkParts parts = watcher->result();
+  if (parts.size() != chunk.indices.size()) {
+    //  an error document, or an image of another size than asked for
+    rejectChunk(chunk);
+    return;
   }
 
+  for (std::size_t i = 0; i < parts.size(); i++) {
+    const ChunkPart &part = parts[i];
+    MapTile &tile = tiles_[chunk.indices[i]];
+    tile.setInChunk(false);
+    tile.setHasImage(true);
+    unresolved_--;
+    cache_->store(tile.x(), tile.y(), tile.z(), part.data, chunk.meta);
+    cache_->unlock(tile.x(), tile.y(), tile.z());
+    decode_jobs_.push_back(
+        DecodeJob(chunk.indices[i], QByteArray(), part.checksum, part.image));
+    finishDownload(tile, kDownloaded, part.data, part.checksum);
+  }
+  emit receivedImage(chunk.request);
+  pumpDecoding();
+  dispatchPending();
   checkIfLoadingComplete();
 }
 
+void TileLoader::rejectChunk(const WmsChunk &chunk) {
+  ROS_WARN("Failed loading %s, requesting its tiles one by one",
+           qPrintable(chunk.request.url().toString()));
+  wms_chunks_ = false;
+  for (auto index = chunk.indices.rbegin(); index != chunk.indices.rend();
+       ++index) {
+    MapTile &tile = tiles_[*index];
+    tile.setInChunk(false);
+    //  claimed again, but still owned in the process
+    cache_->unlock(tile.x(), tile.y(), tile.z());
+    pending_.push_front(*index);
+  }
+  dispatchPending();
+}
+
 double TileLoader::resolution() const {
   return zoomToResolution(latitude_, zoom_);
 }
@@ -197,113 +780,544 @@ double TileLoader::zoomToResolution(double lat, unsigned int zoom) {
 }
 
 void TileLoader::finishedRequest(QNetworkReply *reply) {
+  if (chunks_.count(reply)) {
+    finishedChunk(reply);
+    return;
+  }
   const QNetworkRequest request = reply->request();
 
+  //  find corresponding tile, this may be the original or hedged request
+  const auto it = replies_.find(reply);
+  if (it == replies_.end()) {
+    //  removed from list already, ignore this reply
+    reply->deleteLater();
+    return;
+  }
+  const std::size_t index = it->second;
+  replies_.erase(it);
+  MapTile &tile = tiles_[index];
 
-  QVariant possibleRedirectUrl = reply->attribute(QNetworkRequest::RedirectionTargetAttribute);
-
-   /* We'll deduct if the redirection is valid in the redirectUrl function */
-   _urlRedirectedTo = this->redirectUrl(possibleRedirectUrl.toUrl(),
-                                        _urlRedirectedTo);
-
-   /* If the URL is not empty, we're being redirected. */
-   if(!_urlRedirectedTo.isEmpty()) {
-       QString text = QString("QNAMRedirect::replyFinished: Redirected to ")
-                             .append(_urlRedirectedTo.toString());
-       emit warnOcurred(text);
-       /* We'll do another request to the redirection url. */
-       qnam_->get(QNetworkRequest(_urlRedirectedTo));
-   } else {
-      //  find corresponding tile
-      const std::vector<MapTile>::iterator it =
-          std::find_if(tiles_.begin(), tiles_.end(),
-                       [&](const MapTile &tile) { return tile.reply() == reply; });
-      if (it == tiles_.end()) {
-        //  removed from list already, ignore this reply
-        return;
+  const QUrl redirect =
+      reply->attribute(QNetworkRequest::RedirectionTargetAttribute).toUrl();
+  if (!redirect.isEmpty() && tile.redirects() < kMaxRedirects) {
+    //  follow the redirect on behalf of the same tile
+    const QUrl target = reply->url().resolved(redirect);
+    const int status =
+        reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    if (status == 301 || status == 308) {
+      //  permanent, later tiles can go to the new location directly
+      const bool from_mirror =
+          (tile.hedgeReply() == reply && !hedge_uri_.empty());
+      const std::string &object_uri = from_mirror ? hedge_uri_ : object_uri_;
+      if (learned_redirects.learn(object_uri,
+                                  reply->url().toString().toStdString(),
+                                  target.toString().toStdString())) {
+        ROS_INFO("Learned redirect of %s to %s", object_uri.c_str(),
+                 learned_redirects.apply(object_uri).c_str());
       }
-      MapTile &tile = *it;
-
-      if (reply->error() == QNetworkReply::NoError) {
-        //  decode an image
-        QImageReader reader(reply);
-        if (reader.canRead()) {
-          QImage image = reader.read();
-          tile.setImage(image);
-          image.save(cachedPathForTile(tile.x(), tile.y(), tile.z()), "JPEG");
-          emit receivedImage(request);
-        } else {
-          //  probably not an image
-          QString err;
-          err = "Unable to decode image at " + request.url().toString();
-          emit errorOcurred(err);
+    }
+    ROS_DEBUG("Redirected %s to %s", qPrintable(reply->url().toString()),
+              qPrintable(target.toString()));
+
+    QNetworkRequest next = request;
+    next.setUrl(target);
+    QNetworkReply *rep = qnam_->get(next);
+    QObject::connect(rep, SIGNAL(readyRead()), this, SLOT(receivedData()));
+    replies_[rep] = index;
+    emit initiatedRequest(next);
+    tile.replaceReply(reply, rep);
+    tile.addRedirect();
+    reply->deleteLater();
+    return;
+  } else if (!redirect.isEmpty()) {
+    const QString err = "Too many redirects loading " +
+                        request.url().toString();
+    emit warnOcurred(err);
+  }
+
+  const bool is_hedge = (tile.hedgeReply() == reply);
+  const qint64 latency =
+      is_hedge ? tile.hedgeElapsed() : tile.requestElapsed();
+  if (is_hedge) {
+    tile.setHedgeReply(nullptr);
+  } else {
+    tile.setReply(nullptr);
+  }
+  in_flight_--;
+  const QByteArray data = reply->readAll();
+  reportToController(reply, latency, data.size());
+
+  if (reply->error() != QNetworkReply::NoError && tile.isLoading()) {
+    //  the other request for this tile may still succeed
+    reply->deleteLater();
+    dispatchPending();
+    return;
+  }
+
+  //  a tile that already has an image is being revalidated
+  const bool revalidation = tile.hasImage();
+  bool updated = false;
+  QByteArray checksum;
+  if (reply->error() == QNetworkReply::NoError) {
+    //  first response wins, cancel the other request
+    if (tile.isLoading()) {
+      in_flight_--;
+      replies_.erase(tile.reply() ? tile.reply() : tile.hedgeReply());
+      tile.abortLoading();
+    }
+    if (latency_tracker_) {
+      latency_tracker_->addSample(latency);
+    }
+    const int status =
+        reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    if (status == 304) {
+      //  cached tile is still valid, only its lifetime is renewed
+      cache_->storeMetadata(
+          tile.x(), tile.y(), tile.z(),
+          TileCache::metadataFromReply(reply,
+                            cache_->metadata(tile.x(), tile.y(), tile.z())));
+      ROS_DEBUG("Revalidated %s", qPrintable(request.url().toString()));
+    } else {
+      //  only check that this is an image, it is decoded on the thread pool
+      QBuffer buffer;
+      buffer.setData(data);
+      QImageReader reader(&buffer);
+      if (reader.canRead()) {
+        if (!revalidation) {
+          unresolved_--;
         }
+        //  identical tiles, e.g. open sea, share one texture
+        checksum = TileCache::checksum(data);
+        tile.setHasImage(true);
+        cache_->store(tile.x(), tile.y(), tile.z(), data,
+                      TileCache::metadataFromReply(reply));
+        decode_jobs_.push_back(DecodeJob(index, data, checksum));
+        pumpDecoding();
+        updated = true;
+        emit receivedImage(request);
+      } else if (!revalidation && data.isEmpty() &&
+                 (status == 200 || status == 204)) {
+        //  204 or empty body: nothing to show here
+        tile.setMissing(true);
+        unresolved_--;
+        cache_->markMissing(tile.x(), tile.y(), tile.z());
       } else {
-        const QString err = "Failed loading " + request.url().toString() +
-                            " with code " + QString::number(reply->error());
+        //  probably not an image
+        QString err;
+        err = "Unable to decode image at " + request.url().toString();
         emit errorOcurred(err);
+        if (!revalidation) {
+          //  failed, not retried: the window is loaded without it
+          unresolved_--;
+        }
       }
-      checkIfLoadingComplete();
-   }
-   /* Clean up. */
-   reply->deleteLater();
+    }
+  } else if (!revalidation &&
+             (reply->error() == QNetworkReply::ContentNotFoundError ||
+              reply->error() == QNetworkReply::ContentGoneError)) {
+    //  outside the coverage of the server, e.g. over the ocean
+    ROS_DEBUG("No tile at %s", qPrintable(request.url().toString()));
+    tile.setMissing(true);
+    unresolved_--;
+    cache_->markMissing(tile.x(), tile.y(), tile.z());
+  } else if (revalidation) {
+    //  keep serving the cached tile
+    ROS_DEBUG("Failed revalidating %s with code %d",
+              qPrintable(request.url().toString()), reply->error());
+  } else {
+    const QString err = "Failed loading " + request.url().toString() +
+                        " with code " + QString::number(reply->error());
+    emit errorOcurred(err);
+    //  failed, not retried: the window is loaded without it
+    unresolved_--;
+  }
+  if (!revalidation) {
+    cache_->unlock(tile.x(), tile.y(), tile.z());
+    if (tile.hasImage()) {
+      finishDownload(tile, kDownloaded, data, checksum);
+    } else {
+      finishDownload(tile, tile.isMissing() ? kMissing : kFailed);
+    }
+  }
+  dispatchPending();
+  if (!revalidation || updated) {
+    checkIfLoadingComplete();
+  }
+
+  /* Clean up. */
+  reply->deleteLater();
 }
 
+void TileLoader::receivedData() {
+  QNetworkReply *reply = qobject_cast<QNetworkReply *>(sender());
+  const auto it = replies_.find(reply);
+  if (!reply || it == replies_.end()) {
+    return;
+  }
+  MapTile &tile = tiles_[it->second];
+  //  cached tiles are better than a preview, and hedges race the same bytes
+  if (tile.hasImage() || tile.reply() != reply ||
+      reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt() !=
+          200) {
+    return;
+  }
+  if (tile.previewScans() < 0) {
+    return; //  not progressive
+  }
+  //  left in the reply for finishedRequest()
+  const QByteArray data = reply->peek(reply->bytesAvailable());
+  if (tile.previewScans() == 0) {
+    //  until the frame header has arrived
+    const int progressive =
+        ProgressiveJpeg::isProgressive(data.constData(), data.size());
+    if (progressive < 0) {
+      tile.setPreviewScans(-1);
+    }
+    if (progressive <= 0) {
+      return;
+    }
+  }
+  int end = 0;
+  const int scans =
+      ProgressiveJpeg::completedScans(data.constData(), data.size(), end);
+  if (scans <= tile.previewScans()) {
+    return;
+  }
+  tile.setPreviewScans(scans);
+  if (!output_->tryReserve()) {
+    return; //  not worth waiting for
+  }
+  DecodedTile preview(tile.x(), tile.y());
+  preview.scale = scaleForTile(tile);
+  preview.preview = true;
+  //  cut after the last complete scan and closed, so that the decoder
+  //  neither reads a partial scan nor reports the image truncated
+  QtConcurrent::run(&TileLoader::decode, output_,
+                    std::shared_ptr<LayeredTileCache>(), tile.z(), preview,
+                    data.left(end) + QByteArray("\xFF\xD9", 2));
+}
+
+void TileLoader::hedgeSlowRequests() {
+  if (!qnam_ || !latency_tracker_ ||
+      latency_tracker_->size() < kHedgeMinSamples) {
+    return;
+  }
+  const double threshold = std::max(
+      kHedgeMinDelayMs, latency_tracker_->percentile(kHedgePercentile));
+  //  cap the extra load, but always allow at least one hedge
+  const int budget =
+      std::max(1, static_cast<int>(kMaxHedgeFraction * requests_sent_));
+  const std::string &source = hedge_uri_.empty() ? object_uri_ : hedge_uri_;
 
-QUrl TileLoader::redirectUrl(const QUrl& possibleRedirectUrl,
-                               const QUrl& oldRedirectUrl) const {
-    QUrl redirectUrl;
-    /*
-     * Check if the URL is empty and
-     * that we aren't being fooled into a infinite redirect loop.
-     * We could also keep track of how many redirects we have been to
-     * and set a limit to it, but we'll leave that to you.
-     */
-    if(!possibleRedirectUrl.isEmpty() &&
-       possibleRedirectUrl != oldRedirectUrl) {
-        redirectUrl = possibleRedirectUrl;
+  for (std::size_t index = 0; index < tiles_.size(); index++) {
+    MapTile &tile = tiles_[index];
+    if (hedges_sent_ >= budget) {
+      hedge_timer_->stop();
+      break;
+    }
+    //  revalidations of cached tiles are never urgent
+    if (tile.reply() && !tile.hasImage() && !tile.hedged() &&
+        tile.requestElapsed() > threshold) {
+      ROS_DEBUG("hedging tile=(%d,%d) after %lld ms", tile.x(), tile.y(),
+                static_cast<long long>(tile.requestElapsed()));
+      tile.setHedgeReply(
+          sendRequest(index, uriForTile(source, tile.x(), tile.y(), zoom_)));
+      hedges_sent_++;
     }
-    return redirectUrl;
+  }
 }
 
 bool TileLoader::checkIfLoadingComplete() {
-  const bool loaded =
-      std::all_of(tiles_.begin(), tiles_.end(),
-                  [](const MapTile &tile) { return tile.hasImage(); });
+  const bool loaded = (unresolved_ == 0);
   if (loaded) {
+    hedge_timer_->stop();
     emit finishedLoading();
   }
   return loaded;
 }
 
+void TileLoader::pumpDecoding() {
+  bool failed = false;
+  while (!decode_jobs_.empty() && output_->tryReserve()) {
+    const DecodeJob job = decode_jobs_.front();
+    decode_jobs_.pop_front();
+    MapTile &tile = tiles_[job.index];
+    DecodedTile decoded(tile.x(), tile.y());
+    decoded.scale = scaleForTile(tile);
+    //  pixel files hold full resolution tiles only
+    const bool pixel_cache = pixel_cache_ && decoded.scale == 1;
+    if (!job.data.isEmpty() || !job.image.isNull()) {
+      decoded.checksum = job.checksum;
+      decoded.image = job.image;
+      QtConcurrent::run(&TileLoader::decode, output_,
+                        pixel_cache ? cache_
+                                    : std::shared_ptr<LayeredTileCache>(),
+                        tile.z(), decoded, job.data);
+      continue;
+    }
+
+    //  cached, often decoded in memory or as pixels already
+    if (pixel_cache) {
+      decoded.pixels =
+          cache_->loadPixels(tile.x(), tile.y(), tile.z(), &decoded.checksum);
+    }
+    if (!decoded.pixels) {
+      decoded.image = cache_->load(tile.x(), tile.y(), tile.z(),
+                                   &decoded.checksum, decoded.scale);
+      if (pixel_cache && !decoded.image.isNull()) {
+        //  not decoded again on the next start
+        cache_->storePixels(tile.x(), tile.y(), tile.z(), decoded.checksum,
+                            decoded.image);
+      }
+    }
+    if (decoded.hasImage()) {
+      output_->push(std::move(decoded));
+      continue;
+    }
+
+    //  corrupt, or evicted since load(): download it again
+    output_->release();
+    tile.setHasImage(false);
+    if (tile.isLoading()) {
+      //  a revalidation, which would not send the bytes
+      in_flight_--;
+      replies_.erase(tile.reply());
+      tile.abortLoading();
+    }
+    if (offline_mode_) {
+      tile.setMissing(true);
+    } else {
+      pending_.push_back(job.index);
+      unresolved_++;
+      failed = true;
+    }
+  }
+
+  if (decode_jobs_.empty()) {
+    decode_timer_->stop();
+  } else if (!decode_timer_->isActive()) {
+    decode_timer_->start();
+  }
+  if (failed) {
+    dispatchPending();
+  }
+}
+
+int TileLoader::scaleForTile(const MapTile &tile) const {
+  if (detail_blocks_ < 0) {
+    return 1;
+  }
+  const int distance = std::max(std::abs(tile.x() - center_tile_x_),
+                                std::abs(tile.y() - center_tile_y_));
+  int scale = 1;
+  for (int block = detail_blocks_; block < distance && scale < kMaxDecodeScale;
+       block++) {
+    scale *= 2;
+  }
+  return scale;
+}
+
+void TileLoader::decode(std::shared_ptr<OutputQueue> output,
+                        std::shared_ptr<LayeredTileCache> cache, int z,
+                        DecodedTile tile, QByteArray data) {
+  if (tile.image.isNull()) {
+    tile.image = TileCache::decodeForUpload(data, tile.scale);
+  } else {
+    //  cut from a WMS image
+    if (tile.scale > 1) {
+      tile.image = tile.image.scaled(
+          tile.image.width() / tile.scale, tile.image.height() / tile.scale,
+          Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
+    }
+    tile.image = TileCache::toUploadLayout(tile.image);
+  }
+  if (tile.image.isNull()) {
+    if (!tile.preview) {
+      ROS_WARN("Failed decoding tile=(%d,%d,%d)", tile.x, tile.y, z);
+    }
+    output->release();
+    return;
+  }
+  if (cache) {
+    cache->storePixels(tile.x, tile.y, z, tile.checksum, tile.image);
+  }
+  output->push(std::move(tile));
+}
+
+bool TileLoader::joinDownload(MapTile &tile) {
+  std::lock_guard<std::mutex> lock(shared_downloads_mutex);
+  SharedDownload &download = shared_downloads[std::make_pair(
+      object_uri_, TileCoord(tile.x(), tile.y(), tile.z()))];
+  if (!download.owner || download.owner == this) {
+    download.owner = this;
+    return false;
+  }
+  if (std::find(download.waiters.begin(), download.waiters.end(), this) ==
+      download.waiters.end()) {
+    download.waiters.push_back(this);
+  }
+  tile.setWaiting(true);
+  return true;
+}
+
+void TileLoader::finishDownload(const MapTile &tile, DownloadOutcome outcome,
+                                const QByteArray &data,
+                                const QByteArray &checksum) {
+  std::lock_guard<std::mutex> lock(shared_downloads_mutex);
+  const auto it = shared_downloads.find(
+      std::make_pair(object_uri_, TileCoord(tile.x(), tile.y(), tile.z())));
+  if (it == shared_downloads.end() || it->second.owner != this) {
+    return;
+  }
+  //  waiters are on other threads, and cannot be deleted while listed
+  for (TileLoader *waiter : it->second.waiters) {
+    QMetaObject::invokeMethod(waiter, "finishedSharedDownload",
+                              Qt::QueuedConnection, Q_ARG(int, tile.x()),
+                              Q_ARG(int, tile.y()), Q_ARG(int, outcome),
+                              Q_ARG(QByteArray, data),
+                              Q_ARG(QByteArray, checksum));
+  }
+  shared_downloads.erase(it);
+}
+
+void TileLoader::leaveDownloads() {
+  std::lock_guard<std::mutex> lock(shared_downloads_mutex);
+  for (auto it = shared_downloads.begin(); it != shared_downloads.end();) {
+    SharedDownload &download = it->second;
+    if (download.owner == this) {
+      //  the waiters download it themselves
+      for (TileLoader *waiter : download.waiters) {
+        QMetaObject::invokeMethod(
+            waiter, "finishedSharedDownload", Qt::QueuedConnection,
+            Q_ARG(int, it->first.second.x), Q_ARG(int, it->first.second.y),
+            Q_ARG(int, kFailed), Q_ARG(QByteArray, QByteArray()),
+            Q_ARG(QByteArray, QByteArray()));
+      }
+      it = shared_downloads.erase(it);
+      continue;
+    }
+    download.waiters.erase(
+        std::remove(download.waiters.begin(), download.waiters.end(), this),
+        download.waiters.end());
+    ++it;
+  }
+}
+
+void TileLoader::finishedSharedDownload(int x, int y, int outcome,
+                                        QByteArray data, QByteArray checksum) {
+  if (tiles_.empty() || !inWindow(x, y)) {
+    return;
+  }
+  const std::size_t index = indexOf(x, y);
+  MapTile &tile = tiles_[index];
+  if (!tile.isWaiting()) {
+    return; //  e.g. aborted since
+  }
+  tile.setWaiting(false);
+  switch (outcome) {
+  case kDownloaded:
+    tile.setHasImage(true);
+    unresolved_--;
+    if (!cache_->contains(x, y, zoom_)) {
+      //  downloaded into another cache folder
+      cache_->store(x, y, zoom_, data, TileCache::Metadata());
+    }
+    decode_jobs_.push_back(DecodeJob(index, data, checksum));
+    pumpDecoding();
+    break;
+  case kCached:
+    tile.setHasImage(true);
+    unresolved_--;
+    decode_jobs_.push_back(DecodeJob(index));
+    pumpDecoding();
+    break;
+  case kMissing:
+    tile.setMissing(true);
+    unresolved_--;
+    break;
+  default:
+    //  try again, possibly waiting for another loader
+    pending_.push_front(index);
+    dispatchPending();
+    return;
+  }
+  checkIfLoadingComplete();
+}
+
 QUrl TileLoader::uriForTile(int x, int y) const {
-  std::string object = object_uri_;
+  return uriForTile(object_uri_, x, y, zoom_);
+}
+
+QUrl TileLoader::uriForTile(const std::string &object_uri, int x, int y,
+                            int z) {
+  if (isWms(object_uri)) {
+    return uriForArea(object_uri, TileArea(z, x, y, x, y));
+  }
+  std::string object = learned_redirects.apply(object_uri);
   //  place {x},{y},{z} with appropriate values
-  replaceRegex(boost::regex("\\{x\\}", boost::regex::icase), object,
-               std::to_string(x));
-  replaceRegex(boost::regex("\\{y\\}", boost::regex::icase), object,
-               std::to_string(y));
-  replaceRegex(boost::regex("\\{z\\}", boost::regex::icase), object,
-               std::to_string(zoom_));
+  replaceRegex(kPlaceholderX, object, std::to_string(x));
+  replaceRegex(kPlaceholderY, object, std::to_string(y));
+  replaceRegex(kPlaceholderZ, object, std::to_string(z));
 
   const QString qstr = QString::fromStdString(object);
   return QUrl(qstr);
 }
 
-QString TileLoader::cachedNameForTile(int x, int y, int z) const {
-  return "x" + QString::number(x) + "_y" + QString::number(y) + "_z" +
-         QString::number(z) + ".jpg";
+bool TileLoader::isWms(const std::string &object_uri) {
+  return boost::regex_search(object_uri, kPlaceholderBbox);
 }
 
-QString TileLoader::cachedPathForTile(int x, int y, int z) const {
-  return QDir::cleanPath(cache_path_ + QDir::separator() +
-                         cachedNameForTile(x, y, z));
+QUrl TileLoader::uriForArea(const std::string &object_uri,
+                            const TileArea &area) {
+  std::string object = learned_redirects.apply(object_uri);
+  //  tiles are squares of the web mercator projection, from the north west
+  const double tile_extent = 2 * kMercatorHalfExtent / (1 << area.z);
+  const double min_x = area.min_x * tile_extent - kMercatorHalfExtent;
+  const double max_x = (area.max_x + 1) * tile_extent - kMercatorHalfExtent;
+  const double max_y = kMercatorHalfExtent - area.min_y * tile_extent;
+  const double min_y = kMercatorHalfExtent - (area.max_y + 1) * tile_extent;
+  char bbox[128];
+  std::snprintf(bbox, sizeof(bbox), "%.6f,%.6f,%.6f,%.6f", min_x, min_y,
+                max_x, max_y);
+  replaceRegex(kPlaceholderBbox, object, bbox);
+  replaceRegex(kPlaceholderWidth, object,
+               std::to_string((area.max_x - area.min_x + 1) * kWmsTileSize));
+  replaceRegex(kPlaceholderHeight, object,
+               std::to_string((area.max_y - area.min_y + 1) * kWmsTileSize));
+
+  const QString qstr = QString::fromStdString(object);
+  return QUrl(qstr);
 }
 
 int TileLoader::maxTiles() const { return (1 << zoom_) - 1; }
 
 void TileLoader::abort() {
+  QMetaObject::invokeMethod(this, "abortRequests", Qt::QueuedConnection);
+}
+
+void TileLoader::abortRequests() {
+  hedge_timer_->stop();
+  lock_timer_->stop();
+  decode_timer_->stop();
+  releaseLocks();
+  leaveDownloads();
+  //  replies finishing from now on are ignored
+  replies_.clear();
+  std::map<QNetworkReply *, WmsChunk> chunks;
+  chunks.swap(chunks_);
+  for (const auto &chunk : chunks) {
+    chunk.first->abort();
+  }
+  //  their results are dropped, see finishedSplit()
+  splits_.clear();
+  for (MapTile &tile : tiles_) {
+    //  the network access manager may outlive this loader, see load()
+    tile.abortLoading();
+  }
   tiles_.clear();
+  pending_.clear();
+  locked_.clear();
+  decode_jobs_.clear();
   //  destroy network access manager
   qnam_.reset();
 }
@@ -18,19 +18,52 @@
 #include <QString>
 #include <QNetworkReply>
 #include <QUrl>
+#include <QElapsedTimer>
+#include <QFutureWatcher>
+#include <QTimer>
+#include <atomic>
+#include <deque>
+#include <map>
+#include <unordered_map>
 #include <vector>
 #include <memory>
 
+#include "layered_tilecache.h"
+#include "tile_queue.h"
+
+class LatencyTracker;
+class ConcurrencyController;
+
+/**
+ * @class TileLoader
+ * @brief Loads a window of tiles from the cache and the tile server.
+ *
+ * The loader may be moved to a thread of its own. start(), abort() and the
+ * setters can be called from any thread, they are carried out on the thread
+ * of the loader. Signals are emitted from that thread.
+ *
+ * Decoded tiles are handed over through the lock-free output() queue rather
+ * than signals. Downloaded tiles are decoded on the global thread pool.
+ *
+ * Object URIs with a {bbox} token describe WMS servers. Their tiles are
+ * requested by chunks of the window, each one GetMap request whose image is
+ * split into tiles.
+ */
 class TileLoader : public QObject {
   Q_OBJECT
 public:
+  /// Max number of redirects followed for one tile.
+  static constexpr int kMaxRedirects = 5;
+
   class MapTile {
   public:
     MapTile(int x, int y, int z, QNetworkReply *reply = nullptr)
-        : x_(x), y_(y), z_(z), reply_(reply) {}
-      
-    MapTile(int x, int y, int z, QImage & image)
-      : x_(x), y_(y), z_(z), reply_(nullptr), image_(image) {}
+        : x_(x), y_(y), z_(z), reply_(nullptr), hedge_reply_(nullptr),
+          hedged_(false), missing_(false), has_image_(false),
+          waiting_(false), in_chunk_(false), redirects_(0),
+          preview_scans_(0) {
+      setReply(reply);
+    }
 
     /// X tile coordinate.
     int x() const { return x_; }
@@ -43,37 +76,154 @@ public:
 
     /// Network reply.
     const QNetworkReply *reply() const { return reply_; }
+    void setReply(QNetworkReply *reply);
+
+    /// Duplicate (hedged) network reply, if one was sent.
+    const QNetworkReply *hedgeReply() const { return hedge_reply_; }
+    void setHedgeReply(QNetworkReply *reply);
 
-    /// Abort the network request for this tile, if applicable.
+    /// Has a hedged request ever been sent for this tile?
+    bool hedged() const { return hedged_; }
+
+    /// Milliseconds since the original request was sent.
+    qint64 requestElapsed() const { return request_time_.elapsed(); }
+
+    /// Milliseconds since the hedged request was sent.
+    qint64 hedgeElapsed() const { return hedge_time_.elapsed(); }
+
+    /// Swap `from` for `to`, keeping the request start time. Used when
+    /// following redirects.
+    void replaceReply(const QNetworkReply *from, QNetworkReply *to);
+
+    /// Number of redirects followed for this tile.
+    int redirects() const { return redirects_; }
+    void addRedirect() { redirects_++; }
+
+    /// Is a network request for this tile still in flight?
+    bool isLoading() const { return reply_ || hedge_reply_ || in_chunk_; }
+
+    /// Is the tile part of a WMS request for several tiles in flight? The
+    /// reply is then not the tile's, see TileLoader::sendChunk().
+    bool inChunk() const { return in_chunk_; }
+    void setInChunk(bool in_chunk) { in_chunk_ = in_chunk; }
+
+    /// Abort the network requests for this tile, if applicable.
     void abortLoading();
 
-    /// Has a tile successfully loaded?
-    bool hasImage() const;
+    /// Has a tile successfully loaded? The image itself goes to output().
+    bool hasImage() const { return has_image_; }
+    void setHasImage(bool has_image) { has_image_ = has_image; }
+
+    /// Does the server not have this tile? Missing tiles count as resolved.
+    bool isMissing() const { return missing_; }
+    void setMissing(bool missing) { missing_ = missing; }
 
-    /// Image associated with this tile.
-    const QImage &image() const { return image_; }
-    void setImage(const QImage &image) { image_ = image; }
+    /// Is another loader of the process downloading this tile for us?
+    bool isWaiting() const { return waiting_; }
+    void setWaiting(bool waiting) { waiting_ = waiting; }
+
+    /// Number of scans of a progressive JPEG the last preview showed, -1 if
+    /// the tile is not a progressive JPEG.
+    int previewScans() const { return preview_scans_; }
+    void setPreviewScans(int scans) { preview_scans_ = scans; }
 
   private:
     int x_;
     int y_;
     int z_;
     QNetworkReply *reply_;
-    QImage image_;
+    QNetworkReply *hedge_reply_;
+    bool hedged_;
+    bool missing_;
+    bool has_image_;
+    bool waiting_;
+    bool in_chunk_;
+    int redirects_;
+    int preview_scans_;
+    QElapsedTimer request_time_;
+    QElapsedTimer hedge_time_;
+  };
+
+  /// Decoded tile, on its way to the render thread.
+  struct DecodedTile {
+    DecodedTile(int x = 0, int y = 0)
+        : x(x), y(y), scale(1), preview(false) {}
+
+    /// Is there anything to show?
+    bool hasImage() const { return !image.isNull() || pixels; }
+
+    /// Size of the image or pixels.
+    int width() const { return pixels ? pixels->width() : image.width(); }
+    int height() const { return pixels ? pixels->height() : image.height(); }
+
+    int x;
+    int y;
+    QImage image;
+    /// Upload-ready pixels, used instead of the image when not null
+    std::shared_ptr<const PixelBlock> pixels;
+    /// Hex SHA-1 of the encoded image, shared by identical tiles. Empty if
+    /// unknown.
+    QByteArray checksum;
+    /// Tile pixels per image pixel, above 1 if decoded at reduced resolution
+    int scale;
+    /// Coarse image decoded from the first scans of a progressive JPEG,
+    /// replaced by the tile once downloaded
+    bool preview;
   };
 
+  typedef TileQueue<DecodedTile> OutputQueue;
+
   explicit TileLoader(const std::string &service, double latitude,
                       double longitude, unsigned int zoom, unsigned int blocks,
                       const std::string &proxy, const std::string &cache_path,
+                      const std::vector<std::string> &base_cache_paths,
                       bool offline_mode,
                       QObject *parent = nullptr);
 
+  ~TileLoader() override;
+
   /// Start loading tiles asynchronously.
   void start();
 
+  /// Record request latencies into `tracker`. May be shared between loaders.
+  /// Must be called before start().
+  void setLatencyTracker(const std::shared_ptr<LatencyTracker> &tracker);
+
+  /// Send a duplicate request for tiles slower than the recent latency
+  /// percentile. The duplicate goes to `mirror_uri` (same token format as
+  /// the object URI) or, if empty, to the object URI again.
+  void setHedging(bool enabled, const std::string &mirror_uri);
+
+  /// Take over the requests of `previous`, e.g. the loader of the window
+  /// before a recentre, for the tiles still in the window, and cancel the
+  /// others. `previous` must live on the same thread as this loader. Must be
+  /// called before start().
+  void setPrevious(const std::shared_ptr<TileLoader> &previous);
+
+  /// Adapt the number of requests in flight with `controller`. May be shared
+  /// between loaders. Without a controller all requests are sent at once.
+  /// Must be called before start().
+  void setConcurrencyController(
+      const std::shared_ptr<ConcurrencyController> &controller);
+
+  /// Cap the size of the cached tiles of the server, 0 for no limit.
+  void setCacheSizeLimit(qint64 bytes) { cache_->setMaxSize(bytes); }
+
+  /// Keep decoded tiles in the cache and load them without decoding. Takes
+  /// effect on the next start().
+  void setPixelCache(bool enabled) { pixel_cache_ = enabled; }
+
+  /// Decode tiles more than `blocks` away from the center tile at reduced
+  /// resolution, halved for each further block down to 1/8. Negative for
+  /// full resolution everywhere. Takes effect on the next start().
+  void setDetailBlocks(int blocks) { detail_blocks_ = blocks; }
+
   /// Meters/pixel of the tiles.
   double resolution() const;
 
+  /// Zoom level of the tiles.
+  unsigned int zoom() const { return zoom_; }
+
   /// X index of central tile.
   int centerTileX() const { return center_tile_x_; }
 
@@ -96,11 +246,43 @@ public:
   /// Convert latitude and zoom level to ground resolution.
   static double zoomToResolution(double lat, unsigned int zoom);
 
+  /// URI for tile [x,y,z] on the server described by `object_uri`, after
+  /// substituting the tokens and applying learned redirects. A GetMap
+  /// request for the tile alone on WMS servers.
+  static QUrl uriForTile(const std::string &object_uri, int x, int y, int z);
+
+  /// Does `object_uri` describe a WMS server, i.e. have a {bbox} token?
+  static bool isWms(const std::string &object_uri);
+
+  /// URI of a WMS GetMap request for the tiles of `area` on the server
+  /// described by `object_uri`, after substituting {bbox} (in EPSG:3857),
+  /// {width} and {height} and applying learned redirects.
+  static QUrl uriForArea(const std::string &object_uri, const TileArea &area);
+
+  /// GET request for `uri` with the rviz_satellite user agent.
+  static QNetworkRequest requestForUri(const QUrl &uri);
+
+  /// Parse a <hostname>:<port> proxy specification.
+  static QNetworkProxy proxyFromString(const std::string &proxy);
+
+  /// Use `proxy` for `qnam`, or the system configuration if it is empty.
+  static void applyProxy(QNetworkAccessManager *qnam,
+                         const QNetworkProxy &proxy);
+
   /// Path to tiles on the server.
   const std::string &objectURI() const { return object_uri_; }
 
-  /// Current set of tiles.
-  const std::vector<MapTile> &tiles() const { return tiles_; }
+  /// Tiles decoded so far, for the render thread to pop. Tiles are only
+  /// decoded while there is room in the queue. A tile is pushed again if the
+  /// server sends a newer version. Progressive JPEGs may be preceded by
+  /// previews as their scans arrive.
+  const std::shared_ptr<OutputQueue> &output() const { return output_; }
+
+  /// Is tile [x,y] in the window of this loader?
+  bool inWindow(int x, int y) const {
+    return x >= min_x_ && x < min_x_ + columns_ && y >= min_y_ &&
+           y < min_y_ + rows_;
+  }
 
   /// Cancel all current requests.
   void abort();
@@ -117,32 +299,175 @@ signals:
 
   void warnOcurred(QString description);
 
+  void concurrencyChanged(int limit);
+
 public slots:
 
 private slots:
 
+  /// Load the tiles, see start().
+  void load();
+
+  /// Cancel all current requests, see abort().
+  void abortRequests();
+
+  /// @see setHedging
+  void applyHedging(bool enabled, QString mirror_uri);
+
   void finishedRequest(QNetworkReply *reply);
 
-  QUrl redirectUrl(const QUrl& possibleRedirectUrl,
-                                 const QUrl& oldRedirectUrl) const;
+  /// Decode a preview of a progressive JPEG being downloaded, if a scan
+  /// completed since the last one.
+  void receivedData();
+
+  /// Send duplicate requests for tiles that are taking too long.
+  void hedgeSlowRequests();
+
+  /// Check on tiles another process is downloading.
+  void pollLockedTiles();
+
+  /// Decode queued tiles while there is room in output().
+  void pumpDecoding();
+
+  /// Store and queue the tiles cut from a WMS image, see splitChunk().
+  void finishedSplit();
+
+  /// Another loader finished the download of tile [x,y] this one waited
+  /// for, see joinDownload(). `outcome` is a DownloadOutcome, `data` the
+  /// bytes of the tile if it was downloaded.
+  void finishedSharedDownload(int x, int y, int outcome, QByteArray data,
+                              QByteArray checksum);
 
 private:
+  /// Tile waiting to be decoded, with its bytes if it was downloaded
+  struct DecodeJob {
+    DecodeJob(std::size_t index, const QByteArray &data = QByteArray(),
+              const QByteArray &checksum = QByteArray(),
+              const QImage &image = QImage())
+        : index(index), data(data), checksum(checksum), image(image) {}
+
+    std::size_t index;
+    QByteArray data;
+    QByteArray checksum;
+    /// Decoded already, e.g. cut from a WMS image
+    QImage image;
+  };
+
+  /// Result of a download shared between the loaders of the process.
+  enum DownloadOutcome { kDownloaded, kCached, kMissing, kFailed };
+
+  /// WMS request for the tiles of a rectangle, see sendChunk()
+  struct WmsChunk {
+    explicit WmsChunk(const TileArea &area) : area(area) {}
+
+    TileArea area;
+    /// Indices into tiles_ of the tiles downloaded, other tiles of the area
+    /// are cached already
+    std::vector<std::size_t> indices;
+    QNetworkRequest request;
+    QElapsedTimer time;
+    /// Caching metadata of the reply, once received
+    TileCache::Metadata meta;
+  };
+
+  /// Tile cut from the image of a WMS chunk
+  struct ChunkPart {
+    QImage image;
+    /// Encoded, for the cache and the other loaders
+    QByteArray data;
+    QByteArray checksum;
+  };
+
+  typedef std::vector<ChunkPart> ChunkParts;
 
   /// Check if loading is complete. Emit signal if appropriate.
   bool checkIfLoadingComplete();
 
+  /// Wait for the download of `tile` if another loader of the process is on
+  /// it, and return true. Otherwise register this loader as the one
+  /// downloading it.
+  bool joinDownload(MapTile &tile);
+
+  /// Hand the outcome of the download of `tile` to the loaders waiting for
+  /// it, if this loader was the one downloading it.
+  void finishDownload(const MapTile &tile, DownloadOutcome outcome,
+                      const QByteArray &data = QByteArray(),
+                      const QByteArray &checksum = QByteArray());
+
+  /// Stop waiting for downloads, and fail those of this loader.
+  void leaveDownloads();
+
   /// URI for tile [x,y]
   QUrl uriForTile(int x, int y) const;
 
-  /// Get name for cached tile [x,y,z]
-  QString cachedNameForTile(int x, int y, int z) const;
+  /// Send a GET request for `uri` on behalf of tiles_[index]. With
+  /// `validators` the request is a low priority conditional GET revalidating
+  /// a cached tile.
+  QNetworkReply *sendRequest(std::size_t index, const QUrl &uri,
+                             const TileCache::Metadata *validators = nullptr);
+
+  /// Send queued requests while below the concurrency limit.
+  void dispatchPending();
+
+  /// Check that tiles_[index], taken from pending_, is to be requested by
+  /// this loader now. False if it is loading already, or if another loader
+  /// or process is downloading it, in which case it waits for them.
+  bool claimDownload(std::size_t index);
+
+  /// Download tiles_[first] from a WMS server, along with the pending tiles
+  /// of the same chunk of the window, in a single GetMap request.
+  void sendChunk(std::size_t first);
+
+  /// Hand the image of a WMS request for several tiles to splitChunk(). If
+  /// the server rejected the request, e.g. because it limits the size of
+  /// images, the tiles are requested one by one.
+  void finishedChunk(QNetworkReply *reply);
+
+  /// Decode the WMS image `data` of `area` and cut out `tiles`, re-encoded
+  /// for the cache. Empty if the image is not of the size of `area`. Runs on
+  /// the thread pool.
+  static ChunkParts splitChunk(QByteArray data, TileArea area,
+                               std::vector<TileCoord> tiles);
 
-  /// Get file path for cached tile [x,y,z].
-  QString cachedPathForTile(int x, int y, int z) const;
+  /// Stop requesting WMS tiles in chunks, and request those of `chunk` one
+  /// by one.
+  void rejectChunk(const WmsChunk &chunk);
+
+  /// Release the download locks of the tiles in flight.
+  void releaseLocks();
+
+  /// Report the outcome of a request to the concurrency controller.
+  void reportToController(const QNetworkReply *reply, qint64 latency,
+                          qint64 bytes);
 
   /// Maximum number of tiles for the zoom level
   int maxTiles() const;
 
+  /// Index into tiles_ of tile [x,y], which must be in the window.
+  std::size_t indexOf(int x, int y) const {
+    return (y - min_y_) * columns_ + (x - min_x_);
+  }
+
+  /// Can requests of `previous` be handed over to this loader?
+  bool canAdopt(const TileLoader &previous) const;
+
+  /// Append tile `from` of `previous` to tiles_ along with its requests in
+  /// flight and its downloaded bytes waiting in `downloaded` (by index), if
+  /// it has any. False, and nothing done, otherwise.
+  bool adoptTile(TileLoader &previous, std::size_t from,
+                 std::unordered_map<std::size_t, DecodeJob> &downloaded);
+
+  /// Reduction `tile` is decoded at, see setDetailBlocks().
+  int scaleForTile(const MapTile &tile) const;
+
+  /// Decode the downloaded bytes `data` of `tile` at its scale and push it
+  /// to `output`, in which a slot is reserved. If `tile` has an image
+  /// already, it is only reduced to its scale. The pixels are stored in
+  /// `cache`, if given. Runs on the thread pool.
+  static void decode(std::shared_ptr<OutputQueue> output,
+                     std::shared_ptr<LayeredTileCache> cache, int z,
+                     DecodedTile tile, QByteArray data);
+
   double latitude_;
   double longitude_;
   unsigned int zoom_;
@@ -157,12 +482,52 @@ private:
 
   std::string object_uri_;
   std::string proxy_;
-  QString cache_path_;
+  std::shared_ptr<LayeredTileCache> cache_;
   bool offline_mode_;
+  std::atomic<bool> pixel_cache_;
+  std::atomic<int> detail_blocks_;
 
+  /// Grid of tiles from (min_x_, min_y_), `columns_` wide, row by row
   std::vector<MapTile> tiles_;
-
-  QUrl _urlRedirectedTo;
+  int min_x_;
+  int min_y_;
+  int columns_;
+  int rows_;
+  /// Tiles with neither an image nor known to be missing, and whose download
+  /// has not failed
+  int unresolved_;
+  /// Index into tiles_ of each reply in flight, hedges and redirects included
+  std::unordered_map<const QNetworkReply *, std::size_t> replies_;
+  /// WMS requests for several tiles in flight
+  std::map<QNetworkReply *, WmsChunk> chunks_;
+  /// WMS images being split on the thread pool, by watcher
+  std::map<QObject *, WmsChunk> splits_;
+  /// Are tiles from a WMS server requested in chunks?
+  bool wms_chunks_;
+
+  std::shared_ptr<LatencyTracker> latency_tracker_;
+  bool hedging_enabled_;
+  std::string hedge_uri_;
+  QTimer *hedge_timer_;
+  int requests_sent_;
+  int hedges_sent_;
+
+  std::shared_ptr<ConcurrencyController> concurrency_;
+  /// Loader whose requests are taken over on load(), see setPrevious()
+  std::shared_ptr<TileLoader> previous_;
+  /// Indices into tiles_ waiting for a request slot
+  std::deque<std::size_t> pending_;
+  /// Indices into tiles_ being downloaded by another process
+  std::deque<std::size_t> locked_;
+  QTimer *lock_timer_;
+  /// Tiles waiting for room in output_, in order
+  std::deque<DecodeJob> decode_jobs_;
+  /// Retries pumpDecoding() while the output queue is full
+  QTimer *decode_timer_;
+  std::shared_ptr<OutputQueue> output_;
+  /// Number of replies currently in flight, hedges included
+  int in_flight_;
+  int last_limit_;
 
   QNetworkProxy _localhostProxy;
 };
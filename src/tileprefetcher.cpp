@@ -0,0 +1,189 @@
+/*
+ * TilePrefetcher.cpp
+ *
+ *  Copyright (c) 2014 Gaeth Cross. Apache 2 License.
+ *
+ *  This file is part of rviz_satellite.
+ *
+ *	Created on: 16/10/2026
+ */
+
+#include "tileprefetcher.h"
+#include "tileloader.h"
+
+#include <QBuffer>
+#include <QDateTime>
+#include <QImageReader>
+#include <QNetworkRequest>
+#include <QUrl>
+#include <QtConcurrentRun>
+#include <algorithm>
+#include <ros/ros.h>
+
+// Default number of prefetch requests in flight.
+static constexpr int kDefaultMaxRequests = 2;
+
+TilePrefetcher::TilePrefetcher(const std::string &service,
+                               const std::string &proxy,
+                               const std::string &cache_path,
+                               const std::vector<std::string> &base_cache_paths,
+                               QObject *parent)
+    : QObject(parent), object_uri_(service), proxy_(proxy),
+      cache_path_(cache_path), base_cache_paths_(base_cache_paths),
+      cache_(std::make_shared<LayeredTileCache>(cache_path, base_cache_paths,
+                                                service)),
+      qnam_(new QNetworkAccessManager(this)),
+      max_requests_(kDefaultMaxRequests), max_rate_(0) {
+  TileLoader::applyProxy(qnam_, TileLoader::proxyFromString(proxy_));
+  QObject::connect(qnam_, SIGNAL(finished(QNetworkReply *)), this,
+                   SLOT(finishedRequest(QNetworkReply *)));
+  rate_timer_.setSingleShot(true);
+  QObject::connect(&rate_timer_, SIGNAL(timeout()), this, SLOT(dispatch()));
+  QObject::connect(&route_check_, SIGNAL(finished()), this,
+                   SLOT(checkedRoute()));
+}
+
+TilePrefetcher::~TilePrefetcher() {
+  for (const std::pair<QNetworkReply *const, Request> &request : requests_) {
+    cache_->unlock(request.second.tile.x, request.second.tile.y,
+                  request.second.tile.z);
+  }
+}
+
+void TilePrefetcher::prefetch(const std::vector<TileCoord> &tiles) {
+  fillQueue(queue_, uncachedTiles(cache_, tiles));
+  dispatch();
+}
+
+void TilePrefetcher::prefetchRoute(const std::vector<TileCoord> &tiles) {
+  //  a few file lookups per tile, too slow for the GUI thread. A check in
+  //  progress is superseded, its result is dropped
+  route_check_.setFuture(
+      QtConcurrent::run(&TilePrefetcher::uncachedTiles,
+                        std::shared_ptr<const LayeredTileCache>(cache_),
+                        tiles));
+}
+
+void TilePrefetcher::checkedRoute() {
+  fillQueue(route_queue_, route_check_.result());
+  dispatch();
+}
+
+std::vector<TileCoord>
+TilePrefetcher::uncachedTiles(std::shared_ptr<const LayeredTileCache> cache,
+                              std::vector<TileCoord> tiles) {
+  const qint64 now = QDateTime::currentMSecsSinceEpoch();
+  tiles.erase(std::remove_if(tiles.begin(), tiles.end(),
+                             [&](const TileCoord &tile) {
+                               return cache->contains(tile.x, tile.y, tile.z) ||
+                                      cache->isMissing(tile.x, tile.y, tile.z,
+                                                       now) ||
+                                      cache->isLocked(tile.x, tile.y, tile.z);
+                             }),
+              tiles.end());
+  return tiles;
+}
+
+void TilePrefetcher::fillQueue(std::deque<TileCoord> &queue,
+                               const std::vector<TileCoord> &tiles) const {
+  queue.clear();
+  for (const TileCoord &tile : tiles) {
+    if (!in_flight_.count(tile)) {
+      queue.push_back(tile);
+    }
+  }
+  if (!queue.empty()) {
+    ROS_DEBUG("prefetching %zu tiles", queue.size());
+  }
+}
+
+void TilePrefetcher::setMaxRequests(int max_requests) {
+  max_requests_ = std::max(1, max_requests);
+  dispatch();
+}
+
+void TilePrefetcher::setMaxRate(double max_rate) {
+  max_rate_ = std::max(0.0, max_rate);
+  dispatch();
+}
+
+void TilePrefetcher::dispatch() {
+  while ((!queue_.empty() || !route_queue_.empty()) &&
+         static_cast<int>(requests_.size()) < max_requests_) {
+    if (max_rate_ > 0 && last_request_.isValid()) {
+      const qint64 wait = static_cast<qint64>(1000 / max_rate_) -
+                          last_request_.elapsed();
+      if (wait > 0) {
+        if (!rate_timer_.isActive()) {
+          rate_timer_.start(static_cast<int>(wait));
+        }
+        return;
+      }
+    }
+    last_request_.start();
+    std::deque<TileCoord> &queue = queue_.empty() ? route_queue_ : queue_;
+    const TileCoord tile = queue.front();
+    queue.pop_front();
+    if (!cache_->tryLock(tile.x, tile.y, tile.z)) {
+      //  another process got there first
+      emit finishedTile(true, 0);
+      continue;
+    }
+    QNetworkRequest request = TileLoader::requestForUri(
+        TileLoader::uriForTile(object_uri_, tile.x, tile.y, tile.z));
+    request.setPriority(QNetworkRequest::LowPriority);
+    requests_.insert(std::make_pair(qnam_->get(request), Request(tile)));
+    in_flight_.insert(tile);
+  }
+}
+
+void TilePrefetcher::finishedRequest(QNetworkReply *reply) {
+  reply->deleteLater();
+  const std::map<QNetworkReply *, Request>::iterator it =
+      requests_.find(reply);
+  if (it == requests_.end()) {
+    return;
+  }
+  Request request = it->second;
+  requests_.erase(it);
+  const TileCoord &tile = request.tile;
+  bool ok = false;
+  qint64 bytes = 0;
+
+  const QUrl redirect =
+      reply->attribute(QNetworkRequest::RedirectionTargetAttribute).toUrl();
+  const int status =
+      reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+  if (!redirect.isEmpty()) {
+    if (request.redirects < TileLoader::kMaxRedirects) {
+      QNetworkRequest next = reply->request();
+      next.setUrl(reply->url().resolved(redirect));
+      request.redirects++;
+      requests_.insert(std::make_pair(qnam_->get(next), request));
+      return;
+    }
+  } else if (reply->error() == QNetworkReply::NoError) {
+    const QByteArray data = reply->readAll();
+    bytes = data.size();
+    //  only check that this is an image, decoding is left to TileLoader
+    QBuffer buffer;
+    buffer.setData(data);
+    QImageReader reader(&buffer);
+    if (reader.canRead()) {
+      ok = cache_->store(tile.x, tile.y, tile.z, data,
+                        TileCache::metadataFromReply(reply));
+    } else if (data.isEmpty() && (status == 200 || status == 204)) {
+      ok = cache_->markMissing(tile.x, tile.y, tile.z);
+    }
+  } else if (reply->error() == QNetworkReply::ContentNotFoundError ||
+             reply->error() == QNetworkReply::ContentGoneError) {
+    ok = cache_->markMissing(tile.x, tile.y, tile.z);
+  } else {
+    ROS_DEBUG("Failed prefetching %s with code %d",
+              qPrintable(reply->url().toString()), reply->error());
+  }
+  cache_->unlock(tile.x, tile.y, tile.z);
+  in_flight_.erase(tile);
+  dispatch();
+  emit finishedTile(ok, bytes);
+}
@@ -0,0 +1,144 @@
+/*
+ * TilePrefetcher.h
+ *
+ *  Copyright (c) 2014 Gaeth Cross. Apache 2 License.
+ *
+ *  This file is part of rviz_satellite.
+ *
+ *	Created on: 16/10/2026
+ */
+
+#ifndef TILEPREFETCHER_H
+#define TILEPREFETCHER_H
+
+#include <QObject>
+#include <QNetworkAccessManager>
+#include <QNetworkProxy>
+#include <QNetworkReply>
+#include <QElapsedTimer>
+#include <QFutureWatcher>
+#include <QTimer>
+#include <deque>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "layered_tilecache.h"
+
+/**
+ * @class TilePrefetcher
+ * @brief Downloads tiles into the cache in the background.
+ *
+ * Unlike TileLoader, which is recreated on every reload, a prefetcher lives
+ * as long as the tile server and cache stay the same, so that prefetches in
+ * flight survive recentring. Requests are sent at low priority and only a
+ * few at a time.
+ */
+class TilePrefetcher : public QObject {
+  Q_OBJECT
+public:
+  /// Tiles found in the read-only caches at `base_cache_paths` are not
+  /// fetched.
+  /// @throw std::runtime_error if the cache folder cannot be created.
+  explicit TilePrefetcher(const std::string &service,
+                          const std::string &proxy,
+                          const std::string &cache_path,
+                          const std::vector<std::string> &base_cache_paths,
+                          QObject *parent = nullptr);
+
+  ~TilePrefetcher() override;
+
+  /// Path to tiles on the server.
+  const std::string &objectURI() const { return object_uri_; }
+
+  /// HTTP proxy, <hostname>:<port> or empty.
+  const std::string &proxyURI() const { return proxy_; }
+
+  /// Base folder of the tile cache.
+  const std::string &cachePath() const { return cache_path_; }
+
+  /// Base folders of the read-only tile caches.
+  const std::vector<std::string> &baseCachePaths() const {
+    return base_cache_paths_;
+  }
+
+  /// Replace the queue with `tiles`, fetched in order. Tiles that are cached,
+  /// known to be missing or already in flight, here or in another process,
+  /// are skipped. Requests in flight are not interrupted.
+  void prefetch(const std::vector<TileCoord> &tiles);
+
+  /// Like prefetch(), for the route queue. It is only served while the
+  /// queue filled by prefetch() is empty. The cache is checked on a worker
+  /// thread, as routes can be long: the queue is replaced once done.
+  void prefetchRoute(const std::vector<TileCoord> &tiles);
+
+  /// Number of requests allowed in flight.
+  void setMaxRequests(int max_requests);
+
+  /// Max number of requests sent per second, 0 for no limit.
+  void setMaxRate(double max_rate);
+
+  /// Number of tiles queued and not yet requested.
+  std::size_t queued() const { return queue_.size() + route_queue_.size(); }
+
+  /// Number of tiles queued or in flight.
+  std::size_t remaining() const { return queued() + requests_.size(); }
+
+signals:
+
+  /// A tile request completed. `ok` if the tile was stored or found missing
+  /// on the server, `bytes` is the size of the response body.
+  void finishedTile(bool ok, qint64 bytes);
+
+private slots:
+
+  void finishedRequest(QNetworkReply *reply);
+
+  /// Replace the route queue with the tiles found missing from the cache.
+  void checkedRoute();
+
+  /// Send queued requests while below the limits.
+  void dispatch();
+
+private:
+  /// A prefetch request in flight.
+  struct Request {
+    Request(const TileCoord &tile) : tile(tile), redirects(0) {}
+
+    TileCoord tile;
+    int redirects;
+  };
+
+  /// Tiles of `tiles` that are neither in `cache`, nor known to be missing,
+  /// nor locked by a download. Any thread.
+  static std::vector<TileCoord>
+  uncachedTiles(std::shared_ptr<const LayeredTileCache> cache,
+                std::vector<TileCoord> tiles);
+
+  /// Replace `queue` with the tiles of `tiles` not in flight.
+  void fillQueue(std::deque<TileCoord> &queue,
+                 const std::vector<TileCoord> &tiles) const;
+
+  std::string object_uri_;
+  std::string proxy_;
+  std::string cache_path_;
+  std::vector<std::string> base_cache_paths_;
+  std::shared_ptr<LayeredTileCache> cache_;
+
+  QNetworkAccessManager *qnam_;
+  std::deque<TileCoord> queue_;
+  std::deque<TileCoord> route_queue_;
+  std::map<QNetworkReply *, Request> requests_;
+  /// Tiles of requests_
+  std::set<TileCoord> in_flight_;
+  /// Cache lookups of the last route
+  QFutureWatcher<std::vector<TileCoord>> route_check_;
+  int max_requests_;
+  double max_rate_;
+  QElapsedTimer last_request_;
+  QTimer rate_timer_;
+};
+
+#endif // TILEPREFETCHER_H
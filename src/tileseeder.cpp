@@ -0,0 +1,234 @@
+/*
+ * TileSeeder.cpp
+ *
+ *  Copyright (c) 2014 Gaeth Cross. Apache 2 License.
+ *
+ *  This file is part of rviz_satellite.
+ *
+ *	Created on: 16/10/2026
+ */
+
+#include "tileseeder.h"
+#include "tileloader.h"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <ros/ros.h>
+
+// Number of tiles handed to the prefetcher at once.
+static constexpr std::size_t kChunkSize = 1024;
+// Interval between progress reports (ms).
+static constexpr int kReportInterval = 5000;
+// Highest zoom level with tile indices that fit in an int.
+static constexpr unsigned int kMaxZoom = 30;
+
+TileSeeder::TileSeeder(const std::string &service, const std::string &proxy,
+                       const std::string &cache_path,
+                       const std::vector<std::string> &base_cache_paths,
+                       const std::vector<LatLon> &polygon,
+                       unsigned int min_zoom, unsigned int max_zoom,
+                       QObject *parent)
+    : QObject(parent), polygon_(polygon), min_zoom_(min_zoom),
+      max_zoom_(max_zoom), prefetcher_(service, proxy, cache_path, base_cache_paths),
+      zoom_(min_zoom), row_(0), exhausted_(false), total_(0), skipped_(0),
+      fetched_(0), failed_(0), bytes_(0), last_report_time_(0),
+      last_report_fetched_(0), last_report_bytes_(0) {
+  if (polygon_.size() < 3) {
+    throw std::invalid_argument("Area needs at least 3 points");
+  }
+  if (min_zoom_ > max_zoom_ || max_zoom_ > kMaxZoom) {
+    throw std::invalid_argument("Invalid zoom range " +
+                                std::to_string(min_zoom_) + "-" +
+                                std::to_string(max_zoom_));
+  }
+
+  for (unsigned int z = min_zoom_; z <= max_zoom_; z++) {
+    const TileArea area = bounds(z);
+    for (int y = area.min_y; y <= area.max_y; y++) {
+      for (const Span &span : rowSpans(y, z)) {
+        total_ += span.second - span.first + 1;
+      }
+    }
+  }
+  row_ = bounds(zoom_).min_y;
+
+  QObject::connect(&prefetcher_, SIGNAL(finishedTile(bool, qint64)), this,
+                   SLOT(finishedTile(bool, qint64)));
+  QObject::connect(&report_timer_, SIGNAL(timeout()), this, SLOT(report()));
+}
+
+void TileSeeder::setMaxRequests(int max_requests) {
+  prefetcher_.setMaxRequests(max_requests);
+}
+
+void TileSeeder::setMaxRate(double max_rate) {
+  prefetcher_.setMaxRate(max_rate);
+}
+
+void TileSeeder::start() {
+  ROS_INFO("Seeding %zu tiles at zoom %u-%u into %s", total_, min_zoom_,
+           max_zoom_, prefetcher_.cachePath().c_str());
+  elapsed_.start();
+  report_timer_.start(kReportInterval);
+  feed();
+  checkIfFinished();
+}
+
+bool TileSeeder::pin() {
+  TileCache cache(prefetcher_.cachePath(), prefetcher_.objectURI());
+  for (unsigned int z = min_zoom_; z <= max_zoom_; z++) {
+    if (!cache.pin(bounds(z))) {
+      return false;
+    }
+  }
+  return true;
+}
+
+TileArea TileSeeder::bounds(unsigned int z) const {
+  double min_x = 0, min_y = 0, max_x = 0, max_y = 0;
+  for (std::size_t i = 0; i < polygon_.size(); i++) {
+    double x, y;
+    TileLoader::latLonToTileCoords(polygon_[i].latitude, polygon_[i].longitude,
+                                   z, x, y);
+    min_x = (i == 0) ? x : std::min(min_x, x);
+    min_y = (i == 0) ? y : std::min(min_y, y);
+    max_x = (i == 0) ? x : std::max(max_x, x);
+    max_y = (i == 0) ? y : std::max(max_y, y);
+  }
+  const int max_tile = static_cast<int>((1u << z) - 1);
+  return TileArea(z, std::max(0, static_cast<int>(std::floor(min_x))),
+                  std::max(0, static_cast<int>(std::floor(min_y))),
+                  std::min(max_tile, static_cast<int>(std::floor(max_x))),
+                  std::min(max_tile, static_cast<int>(std::floor(max_y))));
+}
+
+std::vector<TileSeeder::Span> TileSeeder::rowSpans(int y,
+                                                   unsigned int z) const {
+  std::vector<double> xs, ys;
+  for (const LatLon &point : polygon_) {
+    double tile_x, tile_y;
+    TileLoader::latLonToTileCoords(point.latitude, point.longitude, z, tile_x,
+                                   tile_y);
+    xs.push_back(tile_x);
+    ys.push_back(tile_y);
+  }
+  return rowSpans(xs, ys, y, static_cast<int>((1u << z) - 1));
+}
+
+std::vector<TileSeeder::Span>
+TileSeeder::rowSpans(const std::vector<double> &xs,
+                     const std::vector<double> &ys, int y, int max_tile) {
+  //  a tile overlaps the polygon if an edge passes through its row, or if the
+  //  middle of the row is inside the polygon; edges along the border of a
+  //  tile only touch it
+  std::vector<std::pair<double, double>> ranges;
+  std::vector<double> crossings;
+  const double top = y, bottom = y + 1, middle = y + 0.5;
+  for (std::size_t i = 0; i < xs.size(); i++) {
+    const std::size_t j = (i + 1) % xs.size();
+    const double y0 = std::min(ys[i], ys[j]), y1 = std::max(ys[i], ys[j]);
+    if (y1 <= top || y0 >= bottom) {
+      continue;
+    }
+    //  clip the edge to the row
+    double x0 = xs[i], x1 = xs[j];
+    if (ys[i] != ys[j]) {
+      const double slope = (xs[j] - xs[i]) / (ys[j] - ys[i]);
+      x0 = xs[i] + (std::max(y0, top) - ys[i]) * slope;
+      x1 = xs[i] + (std::min(y1, bottom) - ys[i]) * slope;
+      if ((ys[i] <= middle) != (ys[j] <= middle)) {
+        crossings.push_back(xs[i] + (middle - ys[i]) * slope);
+      }
+    }
+    ranges.push_back(std::make_pair(std::min(x0, x1), std::max(x0, x1)));
+  }
+  std::sort(crossings.begin(), crossings.end());
+  for (std::size_t i = 0; i + 1 < crossings.size(); i += 2) {
+    ranges.push_back(std::make_pair(crossings[i], crossings[i + 1]));
+  }
+
+  //  convert to columns and merge
+  std::vector<Span> spans;
+  for (const std::pair<double, double> &range : ranges) {
+    const int first = std::max(0, static_cast<int>(std::floor(range.first)));
+    const int last =
+        std::min(max_tile, static_cast<int>(std::ceil(range.second)) - 1);
+    if (first <= last) {
+      spans.push_back(Span(first, last));
+    }
+  }
+  std::sort(spans.begin(), spans.end());
+  std::vector<Span> merged;
+  for (const Span &span : spans) {
+    if (!merged.empty() && span.first <= merged.back().second + 1) {
+      merged.back().second = std::max(merged.back().second, span.second);
+    } else {
+      merged.push_back(span);
+    }
+  }
+  return merged;
+}
+
+void TileSeeder::feed() {
+  while (!exhausted_ && prefetcher_.queued() == 0) {
+    std::vector<TileCoord> chunk;
+    while (!exhausted_ && chunk.size() < kChunkSize) {
+      if (row_ > bounds(zoom_).max_y) {
+        if (zoom_ == max_zoom_) {
+          exhausted_ = true;
+          break;
+        }
+        zoom_++;
+        row_ = bounds(zoom_).min_y;
+        continue;
+      }
+      for (const Span &span : rowSpans(row_, zoom_)) {
+        for (int x = span.first; x <= span.second; x++) {
+          chunk.push_back(TileCoord(x, row_, zoom_));
+        }
+      }
+      row_++;
+    }
+    //  tiles already cached or known to be missing are not queued
+    const std::size_t before = prefetcher_.remaining();
+    prefetcher_.prefetch(chunk);
+    skipped_ += chunk.size() - (prefetcher_.remaining() - before);
+  }
+}
+
+void TileSeeder::finishedTile(bool ok, qint64 bytes) {
+  if (ok) {
+    fetched_++;
+  } else {
+    failed_++;
+  }
+  bytes_ += bytes;
+  feed();
+  checkIfFinished();
+}
+
+void TileSeeder::report() {
+  const qint64 now = elapsed_.elapsed();
+  const double interval = std::max<qint64>(1, now - last_report_time_) / 1000.0;
+  ROS_INFO("%zu/%zu tiles (%zu cached, %zu failed), %.1f tiles/s, %.1f kB/s",
+           skipped_ + fetched_ + failed_, total_, skipped_, failed_,
+           (fetched_ - last_report_fetched_) / interval,
+           (bytes_ - last_report_bytes_) / interval / 1000);
+  last_report_time_ = now;
+  last_report_fetched_ = fetched_;
+  last_report_bytes_ = bytes_;
+}
+
+void TileSeeder::checkIfFinished() {
+  if (!exhausted_ || prefetcher_.remaining() > 0) {
+    return;
+  }
+  report_timer_.stop();
+  const double seconds = std::max<qint64>(1, elapsed_.elapsed()) / 1000.0;
+  ROS_INFO("Done: %zu tiles fetched, %zu cached, %zu failed in %.1f s "
+           "(%.1f tiles/s, %.1f kB/s)",
+           fetched_, skipped_, failed_, seconds, fetched_ / seconds,
+           bytes_ / seconds / 1000);
+  emit finished();
+}
@@ -0,0 +1,131 @@
+/*
+ * TileSeeder.h
+ *
+ *  Copyright (c) 2014 Gaeth Cross. Apache 2 License.
+ *
+ *  This file is part of rviz_satellite.
+ *
+ *	Created on: 16/10/2026
+ */
+
+#ifndef TILESEEDER_H
+#define TILESEEDER_H
+
+#include <QObject>
+#include <QElapsedTimer>
+#include <QTimer>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "tileprefetcher.h"
+
+/// A point on the globe, in degrees.
+struct LatLon {
+  LatLon(double latitude, double longitude)
+      : latitude(latitude), longitude(longitude) {}
+
+  double latitude;
+  double longitude;
+};
+
+/**
+ * @class TileSeeder
+ * @brief Downloads every tile of an area over a range of zoom levels.
+ *
+ * Used to fill the cache for offline mode. Tiles are enumerated row by row
+ * and handed to a TilePrefetcher in chunks, so tiles already in the cache are
+ * skipped and an interrupted run resumes where it stopped.
+ */
+class TileSeeder : public QObject {
+  Q_OBJECT
+public:
+  /// Seed the tiles covering `polygon` (at least 3 points, not closed) at
+  /// zoom levels `min_zoom` to `max_zoom`. Tiles in the read-only caches at
+  /// `base_cache_paths` are skipped.
+  /// @throw std::invalid_argument if the polygon or zoom range is invalid.
+  /// @throw std::runtime_error if the cache folder cannot be created.
+  TileSeeder(const std::string &service, const std::string &proxy,
+             const std::string &cache_path,
+             const std::vector<std::string> &base_cache_paths,
+             const std::vector<LatLon> &polygon,
+             unsigned int min_zoom, unsigned int max_zoom,
+             QObject *parent = nullptr);
+
+  /// Number of requests allowed in flight.
+  void setMaxRequests(int max_requests);
+
+  /// Max number of requests sent per second, 0 for no limit.
+  void setMaxRate(double max_rate);
+
+  /// Exempt the bounding box of the area from cache eviction.
+  bool pin();
+
+  /// Number of tiles in the area, over all zoom levels.
+  std::size_t total() const { return total_; }
+
+  /// Number of tiles that could not be fetched.
+  std::size_t failed() const { return failed_; }
+
+  /// Columns [first, last] of tiles in a row.
+  typedef std::pair<int, int> Span;
+
+  /// Tiles of row `y`, among columns 0 to `max_tile`, overlapping the polygon
+  /// with corners (`xs[i]`, `ys[i]`) in tile coordinates. Sorted and merged.
+  static std::vector<Span> rowSpans(const std::vector<double> &xs,
+                                    const std::vector<double> &ys, int y,
+                                    int max_tile);
+
+public slots:
+
+  /// Start downloading. finished() is emitted once every tile was handled.
+  void start();
+
+signals:
+
+  void finished();
+
+private slots:
+
+  void finishedTile(bool ok, qint64 bytes);
+
+  /// Log progress and throughput.
+  void report();
+
+private:
+  /// Tiles of row `y` at zoom `z` overlapping the polygon.
+  std::vector<Span> rowSpans(int y, unsigned int z) const;
+
+  /// Bounding box of the polygon at zoom `z`.
+  TileArea bounds(unsigned int z) const;
+
+  /// Hand the next chunk of tiles to the prefetcher once its queue is empty.
+  void feed();
+
+  /// Emit finished() if every tile was handled.
+  void checkIfFinished();
+
+  std::vector<LatLon> polygon_;
+  unsigned int min_zoom_;
+  unsigned int max_zoom_;
+  TilePrefetcher prefetcher_;
+
+  //  next row to enumerate
+  unsigned int zoom_;
+  int row_;
+  bool exhausted_;
+
+  std::size_t total_;
+  std::size_t skipped_;
+  std::size_t fetched_;
+  std::size_t failed_;
+  qint64 bytes_;
+
+  QTimer report_timer_;
+  QElapsedTimer elapsed_;
+  qint64 last_report_time_;
+  std::size_t last_report_fetched_;
+  qint64 last_report_bytes_;
+};
+
+#endif // TILESEEDER_H
@@ -0,0 +1,115 @@
+/*
+ * test_progressive_jpeg.cpp
+ *
+ *  Copyright (c) 2014 Gaeth Cross. Apache 2 License.
+ *
+ *  This file is part of rviz_satellite.
+ *
+ *	Created on: 16/10/2026
+ */
+
+#include <gtest/gtest.h>
+
+#include <string>
+
+#include "progressive_jpeg.h"
+
+/// Marker segment `marker` with `payload`, after its length.
+static std::string segment(unsigned char marker, const std::string &payload) {
+  const std::size_t length = payload.size() + 2;
+  std::string bytes;
+  bytes += '\xFF';
+  bytes += static_cast<char>(marker);
+  bytes += static_cast<char>(length >> 8);
+  bytes += static_cast<char>(length & 0xFF);
+  return bytes + payload;
+}
+
+static const std::string kSoi("\xFF\xD8", 2);
+static const std::string kEoi("\xFF\xD9", 2);
+static const std::string kApp0 = segment(0xE0, std::string("JFIF\0\1\1", 7));
+static const std::string kSof0 = segment(0xC0, std::string(15, '\1'));
+static const std::string kSof2 = segment(0xC2, std::string(15, '\1'));
+static const std::string kDht = segment(0xC4, std::string(20, '\2'));
+static const std::string kSos = segment(0xDA, std::string(10, '\3'));
+
+static int isProgressive(const std::string &data) {
+  return ProgressiveJpeg::isProgressive(data.data(),
+                                        static_cast<int>(data.size()));
+}
+
+static int completedScans(const std::string &data, int &end) {
+  return ProgressiveJpeg::completedScans(data.data(),
+                                         static_cast<int>(data.size()), end);
+}
+
+TEST(ProgressiveJpeg, FindsTheFrameTypeAfterOtherSegments) {
+  EXPECT_EQ(1, isProgressive(kSoi + kApp0 + kSof2));
+  EXPECT_EQ(-1, isProgressive(kSoi + kApp0 + kSof0));
+  //  huffman tables share the range of the frame markers
+  EXPECT_EQ(1, isProgressive(kSoi + kDht + kSof2));
+  //  fill bytes before a marker
+  EXPECT_EQ(1, isProgressive(kSoi + "\xFF\xFF" + kSof2));
+}
+
+TEST(ProgressiveJpeg, WaitsForTheFrameHeader) {
+  EXPECT_EQ(0, isProgressive(""));
+  EXPECT_EQ(0, isProgressive(kSoi));
+  //  cut in the middle of a segment, or of the marker of the next one
+  const std::string header = kSoi + kApp0 + kSof2;
+  for (std::size_t size = 2; size < kSoi.size() + kApp0.size() + 4; size++) {
+    EXPECT_EQ(0, isProgressive(header.substr(0, size))) << size;
+  }
+}
+
+TEST(ProgressiveJpeg, RejectsOtherData) {
+  EXPECT_EQ(-1, isProgressive("\x89PNG\r\n\x1A\n"));
+  EXPECT_EQ(-1, isProgressive("<?xml version=\"1.0\"?>"));
+  //  a scan without a frame header, or garbage where a marker should be
+  EXPECT_EQ(-1, isProgressive(kSoi + kSos));
+  EXPECT_EQ(-1, isProgressive(kSoi + kApp0 + "\x12\x34\x56\x78"));
+
+  int end = -1;
+  EXPECT_EQ(0, completedScans("\x89PNG\r\n\x1A\n", end));
+  EXPECT_EQ(0, end);
+}
+
+TEST(ProgressiveJpeg, CountsCompleteScans) {
+  //  entropy coded data with a stuffed 0xFF and a restart marker, which do
+  //  not end the scan
+  const std::string first =
+      kSos + std::string("\x11\xFF\x00\x22\xFF\xD0\x33", 7);
+  const std::string second = kSos + std::string("\x44\x55", 2);
+  const std::string header = kSoi + kApp0 + kSof2 + kDht;
+  const std::string image = header + first + second + kEoi;
+  const int first_end = static_cast<int>(header.size() + first.size());
+  const int second_end = first_end + static_cast<int>(second.size());
+
+  int end = -1;
+  EXPECT_EQ(2, completedScans(image, end));
+  EXPECT_EQ(second_end, end);
+
+  //  a scan is complete once the marker after it has arrived
+  for (int size = 0; size <= first_end + 1; size++) {
+    EXPECT_EQ(0, completedScans(image.substr(0, size), end)) << size;
+    EXPECT_EQ(0, end) << size;
+  }
+  for (int size = first_end + 2; size <= second_end + 1; size++) {
+    EXPECT_EQ(1, completedScans(image.substr(0, size), end)) << size;
+    EXPECT_EQ(first_end, end) << size;
+  }
+}
+
+TEST(ProgressiveJpeg, WaitsForTheByteAfterAnFF) {
+  //  0xFF as the last byte may be stuffed or start a marker
+  const std::string data = kSoi + kSof2 + kSos + "\x11\xFF";
+  int end = -1;
+  EXPECT_EQ(0, completedScans(data, end));
+  EXPECT_EQ(1, completedScans(data + '\xDA', end));
+  EXPECT_EQ(0, completedScans(data + std::string(1, '\0'), end));
+}
+
+int main(int argc, char **argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
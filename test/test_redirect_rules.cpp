@@ -0,0 +1,94 @@
+/*
+ * test_redirect_rules.cpp
+ *
+ *  Copyright (c) 2014 Gaeth Cross. Apache 2 License.
+ *
+ *  This file is part of rviz_satellite.
+ *
+ *	Created on: 16/10/2026
+ */
+
+#include <gtest/gtest.h>
+
+#include "redirect_rules.h"
+
+static const std::string kObjectUri = "http://a.tld/v1/{z}/{x}/{y}.png";
+
+TEST(RedirectRules, UnknownUrisAreKept) {
+  RedirectRules rules;
+  EXPECT_EQ(kObjectUri, rules.apply(kObjectUri));
+}
+
+TEST(RedirectRules, RewritesThePrefix) {
+  RedirectRules rules;
+  EXPECT_TRUE(rules.learn(kObjectUri, "http://a.tld/v1/3/4/5.png",
+                          "http://a.tld/v2/3/4/5.png"));
+  EXPECT_EQ("http://a.tld/v2/{z}/{x}/{y}.png", rules.apply(kObjectUri));
+  //  the same redirect of another tile teaches nothing new
+  EXPECT_FALSE(rules.learn(kObjectUri, "http://a.tld/v1/3/4/6.png",
+                           "http://a.tld/v2/3/4/6.png"));
+  //  other object URIs are not affected
+  EXPECT_EQ("http://a.tld/v1/{z}/{y}/{x}.jpg",
+            rules.apply("http://a.tld/v1/{z}/{y}/{x}.jpg"));
+}
+
+TEST(RedirectRules, KeepsOriginsWhole) {
+  RedirectRules rules;
+  //  the common suffix "a.tld/v1/..." would otherwise rewrite "http" only
+  EXPECT_TRUE(rules.learn(kObjectUri, "http://a.tld/v1/3/4/5.png",
+                          "https://a.tld/v1/3/4/5.png"));
+  EXPECT_EQ("https://a.tld/v1/{z}/{x}/{y}.png", rules.apply(kObjectUri));
+}
+
+TEST(RedirectRules, MovesToAnotherHost) {
+  RedirectRules rules;
+  EXPECT_TRUE(rules.learn(kObjectUri, "http://a.tld/v1/3/4/5.png",
+                          "https://tiles.b.tld/v1/3/4/5.png"));
+  EXPECT_EQ("https://tiles.b.tld/v1/{z}/{x}/{y}.png",
+            rules.apply(kObjectUri));
+}
+
+TEST(RedirectRules, FollowsRedirectsOfRedirectedUris) {
+  RedirectRules rules;
+  ASSERT_TRUE(rules.learn(kObjectUri, "http://a.tld/v1/3/4/5.png",
+                          "http://a.tld/v2/3/4/5.png"));
+  //  requested at the learned location, and moved again
+  EXPECT_TRUE(rules.learn(kObjectUri, "http://a.tld/v2/3/4/5.png",
+                          "http://b.tld/v3/3/4/5.png"));
+  EXPECT_EQ("http://b.tld/v3/{z}/{x}/{y}.png", rules.apply(kObjectUri));
+}
+
+TEST(RedirectRules, RedirectsBackDoNotLoop) {
+  RedirectRules rules;
+  ASSERT_TRUE(rules.learn(kObjectUri, "http://a.tld/v1/3/4/5.png",
+                          "http://b.tld/v1/3/4/5.png"));
+  //  rules are applied once, moving back just restores the object URI
+  EXPECT_TRUE(rules.learn(kObjectUri, "http://b.tld/v1/3/4/5.png",
+                          "http://a.tld/v1/3/4/5.png"));
+  EXPECT_EQ(kObjectUri, rules.apply(kObjectUri));
+}
+
+TEST(RedirectRules, IgnoresRedirectsThatWouldRepeat) {
+  RedirectRules rules;
+  //  the target matches the old prefix again, every learn would add a level
+  EXPECT_FALSE(rules.learn("http://a.tld/{z}/{x}/{y}.png",
+                           "http://a.tld/3/4/5.png",
+                           "http://a.tld/tiles/3/4/5.png"));
+  EXPECT_EQ("http://a.tld/{z}/{x}/{y}.png",
+            rules.apply("http://a.tld/{z}/{x}/{y}.png"));
+}
+
+TEST(RedirectRules, IgnoresRedirectsOfOtherUris) {
+  RedirectRules rules;
+  //  the changed part is not in the literal prefix of the object URI
+  EXPECT_FALSE(rules.learn(kObjectUri, "http://c.tld/v1/3/4/5.png",
+                           "http://d.tld/v1/3/4/5.png"));
+  EXPECT_FALSE(rules.learn(kObjectUri, "http://a.tld/v1/3/4/5.png",
+                           "http://a.tld/v1/3/4/5.png"));
+  EXPECT_EQ(kObjectUri, rules.apply(kObjectUri));
+}
+
+int main(int argc, char **argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
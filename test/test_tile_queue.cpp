@@ -0,0 +1,125 @@
+/*
+ * test_tile_queue.cpp
+ *
+ *  Copyright (c) 2014 Gaeth Cross. Apache 2 License.
+ *
+ *  This file is part of rviz_satellite.
+ *
+ *	Created on: 16/10/2026
+ */
+
+#include <gtest/gtest.h>
+
+#include <thread>
+#include <vector>
+
+#include "tile_queue.h"
+
+TEST(TileQueue, CapacityIsRoundedUpToPowerOfTwo) {
+  TileQueue<int> queue(5);
+  EXPECT_EQ(8u, queue.capacity());
+  TileQueue<int> exact(4);
+  EXPECT_EQ(4u, exact.capacity());
+}
+
+TEST(TileQueue, ReservesUntilFull) {
+  TileQueue<int> queue(4);
+  for (int i = 0; i < 4; i++) {
+    EXPECT_TRUE(queue.tryReserve());
+  }
+  EXPECT_FALSE(queue.tryReserve());
+  EXPECT_FALSE(queue.idle());
+}
+
+TEST(TileQueue, QueuedItemsHoldTheirSlot) {
+  TileQueue<int> queue(2);
+  ASSERT_TRUE(queue.tryReserve());
+  queue.push(1);
+  ASSERT_TRUE(queue.tryReserve());
+  queue.push(2);
+  EXPECT_FALSE(queue.tryReserve());
+
+  int item = 0;
+  ASSERT_TRUE(queue.pop(item));
+  EXPECT_TRUE(queue.tryReserve());
+  EXPECT_FALSE(queue.tryReserve());
+}
+
+TEST(TileQueue, ReleaseFreesTheSlot) {
+  TileQueue<int> queue(1);
+  ASSERT_TRUE(queue.tryReserve());
+  EXPECT_FALSE(queue.tryReserve());
+  queue.release();
+  EXPECT_TRUE(queue.idle());
+  EXPECT_TRUE(queue.tryReserve());
+}
+
+TEST(TileQueue, PopsInPushOrder) {
+  TileQueue<int> queue(4);
+  int item = 0;
+  EXPECT_FALSE(queue.pop(item));
+  //  several times around the ring
+  for (int round = 0; round < 3; round++) {
+    for (int i = 0; i < 3; i++) {
+      ASSERT_TRUE(queue.tryReserve());
+      queue.push(round * 10 + i);
+    }
+    for (int i = 0; i < 3; i++) {
+      ASSERT_TRUE(queue.pop(item));
+      EXPECT_EQ(round * 10 + i, item);
+    }
+    EXPECT_FALSE(queue.pop(item));
+    EXPECT_TRUE(queue.idle());
+  }
+}
+
+TEST(TileQueue, ManyProducersOneConsumer) {
+  const int kProducers = 4;
+  const int kItems = 20000;
+  TileQueue<int> queue(16);
+
+  std::vector<std::thread> producers;
+  for (int p = 0; p < kProducers; p++) {
+    producers.push_back(std::thread([&queue, p]() {
+      for (int i = 0; i < kItems; i++) {
+        while (!queue.tryReserve()) {
+          std::this_thread::yield();
+        }
+        //  every other reservation is given back, as failed decodes are
+        if (i % 2) {
+          queue.release();
+        } else {
+          queue.push(p * kItems + i);
+        }
+      }
+    }));
+  }
+
+  //  each producer's items arrive in its order, and all of them
+  std::vector<int> next(kProducers, 0);
+  int popped = 0;
+  while (popped < kProducers * kItems / 2) {
+    int item = 0;
+    if (!queue.pop(item)) {
+      std::this_thread::yield();
+      continue;
+    }
+    const int p = item / kItems;
+    ASSERT_GE(p, 0);
+    ASSERT_LT(p, kProducers);
+    EXPECT_EQ(next[p], item % kItems);
+    next[p] = item % kItems + 2;
+    popped++;
+  }
+  for (std::thread &producer : producers) {
+    producer.join();
+  }
+  int item = 0;
+  EXPECT_FALSE(queue.pop(item));
+  EXPECT_TRUE(queue.idle());
+}
+
+int main(int argc, char **argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,91 @@
+/*
+ * test_tileseeder.cpp
+ *
+ *  Copyright (c) 2014 Gaeth Cross. Apache 2 License.
+ *
+ *  This file is part of rviz_satellite.
+ *
+ *	Created on: 16/10/2026
+ */
+
+#include <gtest/gtest.h>
+
+#include <vector>
+
+#include "tileseeder.h"
+
+typedef TileSeeder::Span Span;
+typedef std::vector<Span> Spans;
+
+static const int kMaxTile = 15;
+
+TEST(TileSeeder, SquareOnTileBorders) {
+  //  tiles 1 to 2 in both directions, the borders touch their neighbours
+  const std::vector<double> xs = {1, 3, 3, 1};
+  const std::vector<double> ys = {1, 1, 3, 3};
+  EXPECT_EQ(Spans(), TileSeeder::rowSpans(xs, ys, 0, kMaxTile));
+  EXPECT_EQ(Spans({Span(1, 2)}), TileSeeder::rowSpans(xs, ys, 1, kMaxTile));
+  EXPECT_EQ(Spans({Span(1, 2)}), TileSeeder::rowSpans(xs, ys, 2, kMaxTile));
+  EXPECT_EQ(Spans(), TileSeeder::rowSpans(xs, ys, 3, kMaxTile));
+}
+
+TEST(TileSeeder, PartiallyCoveredTiles) {
+  const std::vector<double> xs = {0.5, 2.5, 2.5, 0.5};
+  const std::vector<double> ys = {0.5, 0.5, 2.5, 2.5};
+  for (int y = 0; y <= 2; y++) {
+    EXPECT_EQ(Spans({Span(0, 2)}), TileSeeder::rowSpans(xs, ys, y, kMaxTile))
+        << y;
+  }
+  EXPECT_EQ(Spans(), TileSeeder::rowSpans(xs, ys, 3, kMaxTile));
+}
+
+TEST(TileSeeder, ConcavePolygon) {
+  //  a U opening downwards: the inner rows have two spans
+  const std::vector<double> xs = {0, 6, 6, 4, 4, 2, 2, 0};
+  const std::vector<double> ys = {0, 0, 6, 6, 2, 2, 6, 6};
+  EXPECT_EQ(Spans({Span(0, 5)}), TileSeeder::rowSpans(xs, ys, 0, kMaxTile));
+  EXPECT_EQ(Spans({Span(0, 5)}), TileSeeder::rowSpans(xs, ys, 1, kMaxTile));
+  for (int y = 2; y <= 5; y++) {
+    EXPECT_EQ(Spans({Span(0, 1), Span(4, 5)}),
+              TileSeeder::rowSpans(xs, ys, y, kMaxTile))
+        << y;
+  }
+  EXPECT_EQ(Spans(), TileSeeder::rowSpans(xs, ys, 6, kMaxTile));
+}
+
+TEST(TileSeeder, ConcaveNotchWithinTiles) {
+  //  the notch between the arms is narrower than a tile, no gap remains
+  const std::vector<double> xs = {0.5, 5.5, 5.5, 3.2, 3.2, 2.8, 2.8, 0.5};
+  const std::vector<double> ys = {0.5, 0.5, 3.5, 3.5, 1.5, 1.5, 3.5, 3.5};
+  for (int y = 0; y <= 3; y++) {
+    EXPECT_EQ(Spans({Span(0, 5)}), TileSeeder::rowSpans(xs, ys, y, kMaxTile))
+        << y;
+  }
+}
+
+TEST(TileSeeder, PolygonWithinOneRow) {
+  //  the middle of the row is outside: only the edges find the tiles
+  const std::vector<double> xs = {1.2, 4.7, 3.1};
+  const std::vector<double> ys = {2.1, 2.2, 2.4};
+  EXPECT_EQ(Spans({Span(1, 4)}), TileSeeder::rowSpans(xs, ys, 2, kMaxTile));
+  EXPECT_EQ(Spans(), TileSeeder::rowSpans(xs, ys, 1, kMaxTile));
+  EXPECT_EQ(Spans(), TileSeeder::rowSpans(xs, ys, 3, kMaxTile));
+}
+
+TEST(TileSeeder, PolygonWithinOneTile) {
+  const std::vector<double> xs = {2.1, 2.9, 2.5};
+  const std::vector<double> ys = {3.1, 3.1, 3.9};
+  EXPECT_EQ(Spans({Span(2, 2)}), TileSeeder::rowSpans(xs, ys, 3, kMaxTile));
+}
+
+TEST(TileSeeder, ClampsToTheMap) {
+  const std::vector<double> xs = {-2, 20, 20, -2};
+  const std::vector<double> ys = {0.5, 0.5, 1.5, 1.5};
+  EXPECT_EQ(Spans({Span(0, kMaxTile)}),
+            TileSeeder::rowSpans(xs, ys, 0, kMaxTile));
+}
+
+int main(int argc, char **argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}